@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <time.h>
 #include "mpi.h"
+#include "../4-OpenMP-additional/bench-tools.h"
 
 #define COMM_ITERATIONS 50000
 #define BUFF_SIZE 1000
@@ -21,24 +22,36 @@ int main(int argc, char** argv)
     //int32_t* buf = (int32_t*)calloc(BUFF_SIZE, sizeof(int32_t));
     //printf("")
 
-    if (rank == 0) {
-        struct timespec tstart={}, tend={};
-        clock_gettime(CLOCK_MONOTONIC, &tstart);
-
-        for (int i = 0; i < COMM_ITERATIONS; i++) {
-            MPI_Send(buf, BUFF_SIZE, MPI_INT, 1, TAG, MPI_COMM_WORLD);
-            MPI_Recv(buf, BUFF_SIZE, MPI_INT, 1, TAG, MPI_COMM_WORLD, &status);
+    // Both ranks run the same repetitions, rank 0 times them
+    bench_t bench;
+    bench_init(&bench, "communication");
+    bench_set(&bench, "ranks", "%d", size);
+    bench_set(&bench, "message_bytes", "%zu", BUFF_SIZE * sizeof(int32_t));
+
+    for (bench_start(&bench, "ping-pong %zu", BUFF_SIZE * sizeof(int32_t)); bench_running(&bench); ) {
+        MPI_Barrier(MPI_COMM_WORLD);
+        bench_tic(&bench);
+
+        if (rank == 0) {
+            for (int i = 0; i < COMM_ITERATIONS; i++) {
+                MPI_Send(buf, BUFF_SIZE, MPI_INT, 1, TAG, MPI_COMM_WORLD);
+                MPI_Recv(buf, BUFF_SIZE, MPI_INT, 1, TAG, MPI_COMM_WORLD, &status);
+            }
+        }
+        else if (rank == 1) {
+            for (int i = 0; i < COMM_ITERATIONS; i++) {
+                MPI_Recv(buf, BUFF_SIZE, MPI_INT, 0, TAG, MPI_COMM_WORLD, &status);
+                MPI_Send(buf, BUFF_SIZE, MPI_INT, 0, TAG, MPI_COMM_WORLD);
+            }
         }
 
-        clock_gettime(CLOCK_MONOTONIC, &tend);
-        double dt = ((tend.tv_sec - tstart.tv_sec)*1e9 + (tend.tv_nsec - tstart.tv_nsec)) / (COMM_ITERATIONS * 2);
-        printf("Communication time is %.1lfns\n", dt);
+        bench_toc(&bench);
     }
-    else if (rank == 1) {
-        for (int i = 0; i < COMM_ITERATIONS; i++) {
-            MPI_Recv(buf, BUFF_SIZE, MPI_INT, 0, TAG, MPI_COMM_WORLD, &status);
-            MPI_Send(buf, BUFF_SIZE, MPI_INT, 0, TAG, MPI_COMM_WORLD);
-        }
+
+    if (rank == 0) {
+        const double messages = 2.0 * COMM_ITERATIONS;
+        double dt = bench_report(&bench, 0, messages, messages * BUFF_SIZE * sizeof(int32_t)) / messages * 1e9;
+        printf("Communication time is %.1lfns (min %.1lfns, %d reps)\n", dt, bench.min / messages * 1e9, bench.reps);
     }
 
     free(buf);
@@ -0,0 +1,401 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <omp.h>
+#include "mpi.h"
+#include "matrix-tools.h"
+#include "matrix-kernels.h"
+
+/*
+    Distributed C = A*B with SUMMA on a pr x pc process grid. Rank (r, c) owns
+    block (r, c) of A (M x K), B (K x N) and C (M x N), blocks are balanced to
+    within one row/column. The K dimension is walked in panels: the ranks owning
+    the current columns of A broadcast them along their grid row, the ones owning
+    the rows of B along their grid column, and every rank adds the product of the
+    two panels to its C block with one of the OpenMP kernels of matrix-kernels.h.
+
+    Panels are double-buffered: the broadcasts of panel s + 1 are posted with
+    MPI_Ibcast before panel s is multiplied, so the transfer overlaps the local
+    product and only the part that is not hidden shows up as wait time.
+*/
+
+#ifndef SUMMA_DIM
+    #define SUMMA_DIM 2048
+#endif
+#ifndef SUMMA_PANEL
+    #define SUMMA_PANEL 256
+#endif
+
+#define SUMMA_DEFAULT_KERNEL "simd"
+#define TAG 11
+
+enum {
+        SUMMA_SEED_A = 0xA,
+        SUMMA_SEED_B = 0xB,
+        FREIVALDS_ROUNDS = 3
+    };
+
+typedef struct {
+    const char* name;
+    gemm_t gemm;
+} summa_kernel_t;
+
+const summa_kernel_t summa_kernels[] = {
+    {"naive", naive_gemm},
+    {"transpose", transposed_gemm},
+    {"block", block_gemm},
+    {"packed", packed_gemm},
+    {"simd", simd_gemm},
+};
+
+const size_t num_summa_kernels = sizeof(summa_kernels)/sizeof(summa_kernels[0]);
+
+// First row/column of part i when n is split into parts nearly equal parts
+size_t part_start(size_t n, int parts, int i)
+{
+    return n * i / parts;
+}
+
+// Part that holds index k
+int part_owner(size_t n, int parts, size_t k)
+{
+    int i = (int)(k * parts / n);
+    while (part_start(n, parts, i + 1) <= k) {
+        ++i;
+    }
+    while (part_start(n, parts, i) > k) {
+        --i;
+    }
+
+    return i;
+}
+
+// Block of a global rows x cols matrix filled like init_rect_matrix(), so every rank
+// generates its part of the same matrix without communication
+void init_block(long* block, size_t rows, size_t cols, size_t row0, size_t col0, size_t global_cols, unsigned int seed)
+{
+    #pragma omp parallel for schedule(static) if (enable_omp_parallel)
+    for (size_t i = 0; i < rows; ++i) {
+        for (size_t j = 0; j < cols; ++j) {
+            block[i*cols + j] = random_below(random_at(seed, (row0 + i)*global_cols + col0 + j), MATRIX_ELEM_MAX);
+        }
+    }
+}
+
+typedef struct {
+    size_t k0;
+    size_t width;
+    int a_owner;
+    int b_owner;
+} summa_panel_t;
+
+// Panels of at most panel columns that never cross a block boundary of A or B
+size_t plan_panels(size_t K, int pr, int pc, size_t panel, summa_panel_t* panels)
+{
+    size_t count = 0;
+
+    for (size_t k = 0; k < K; ) {
+        int a_owner = part_owner(K, pc, k);
+        int b_owner = part_owner(K, pr, k);
+        size_t end = k + panel;
+        end = (end < part_start(K, pc, a_owner + 1)) ? end : part_start(K, pc, a_owner + 1);
+        end = (end < part_start(K, pr, b_owner + 1)) ? end : part_start(K, pr, b_owner + 1);
+
+        if (panels) {
+            panels[count] = (summa_panel_t){k, end - k, a_owner, b_owner};
+        }
+        ++count;
+        k = end;
+    }
+
+    return count;
+}
+
+typedef struct {
+    double compute;
+    double comm;
+    double total;
+} summa_times_t;
+
+typedef struct {
+    int rank;
+    int row, col;
+    int pr, pc;
+    MPI_Comm comm;
+    MPI_Comm row_comm;
+    MPI_Comm col_comm;
+} summa_grid_t;
+
+// Posts the broadcasts of one panel into Ap (mloc x width) and Bp (width x nloc)
+void post_panel(const summa_grid_t* grid, const summa_panel_t* panel, long* A, size_t lda, size_t a_col0,
+                long* B, size_t b_row0, size_t mloc, size_t nloc, long* Ap, long* Bp, MPI_Request* requests)
+{
+    const size_t w = panel->width;
+
+    if (grid->col == panel->a_owner) {
+        for (size_t i = 0; i < mloc; ++i) {
+            memcpy(&Ap[i*w], &A[i*lda + panel->k0 - a_col0], sizeof(long) * w);
+        }
+    }
+    // Rows of B are already contiguous, the owner broadcasts them in place
+    long* Bsrc = (grid->row == panel->b_owner) ? &B[(panel->k0 - b_row0)*nloc] : Bp;
+
+    MPI_Ibcast(Ap, mloc*w, MPI_LONG, panel->a_owner, grid->row_comm, &requests[0]);
+    MPI_Ibcast(Bsrc, w*nloc, MPI_LONG, panel->b_owner, grid->col_comm, &requests[1]);
+}
+
+summa_times_t summa(const summa_grid_t* grid, gemm_t gemm, size_t M, size_t N, size_t K, size_t panel_width,
+                    long* A, long* B, long* C)
+{
+    const size_t mloc = part_start(M, grid->pr, grid->row + 1) - part_start(M, grid->pr, grid->row);
+    const size_t nloc = part_start(N, grid->pc, grid->col + 1) - part_start(N, grid->pc, grid->col);
+    const size_t kloc_a = part_start(K, grid->pc, grid->col + 1) - part_start(K, grid->pc, grid->col);
+    const size_t a_col0 = part_start(K, grid->pc, grid->col);
+    const size_t b_row0 = part_start(K, grid->pr, grid->row);
+
+    const size_t num_panels = plan_panels(K, grid->pr, grid->pc, panel_width, NULL);
+    summa_panel_t* panels = (summa_panel_t*)malloc(sizeof(summa_panel_t) * num_panels);
+    plan_panels(K, grid->pr, grid->pc, panel_width, panels);
+
+    long* Ap[2] = {(long*)malloc(sizeof(long) * (mloc*panel_width + 1)), (long*)malloc(sizeof(long) * (mloc*panel_width + 1))};
+    long* Bp[2] = {(long*)malloc(sizeof(long) * (panel_width*nloc + 1)), (long*)malloc(sizeof(long) * (panel_width*nloc + 1))};
+    MPI_Request requests[2][2];
+    summa_times_t times = {0, 0, 0};
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start = MPI_Wtime();
+
+    memset(C, 0, sizeof(long) * mloc*nloc);
+    post_panel(grid, &panels[0], A, kloc_a, a_col0, B, b_row0, mloc, nloc, Ap[0], Bp[0], requests[0]);
+
+    for (size_t s = 0; s < num_panels; ++s) {
+        const int cur = s % 2;
+        const summa_panel_t* panel = &panels[s];
+
+        double t = MPI_Wtime();
+        MPI_Waitall(2, requests[cur], MPI_STATUSES_IGNORE);
+        if (s + 1 < num_panels) {
+            post_panel(grid, &panels[s + 1], A, kloc_a, a_col0, B, b_row0, mloc, nloc, Ap[!cur], Bp[!cur], requests[!cur]);
+        }
+        times.comm += MPI_Wtime() - t;
+
+        long* Bcur = (grid->row == panel->b_owner) ? &B[(panel->k0 - b_row0)*nloc] : Bp[cur];
+        t = MPI_Wtime();
+        gemm(mloc, nloc, panel->width, 1, Ap[cur], panel->width, Bcur, nloc, 1, C, nloc);
+        times.compute += MPI_Wtime() - t;
+    }
+
+    times.total = MPI_Wtime() - start;
+
+    for (int i = 0; i < 2; ++i) {
+        free(Ap[i]);
+        free(Bp[i]);
+    }
+    free(panels);
+
+    return times;
+}
+
+// Collects the C blocks on rank 0 and checks them against A and B built there
+int verify_summa(const summa_grid_t* grid, size_t M, size_t N, size_t K, long* C)
+{
+    const size_t mloc = part_start(M, grid->pr, grid->row + 1) - part_start(M, grid->pr, grid->row);
+    const size_t nloc = part_start(N, grid->pc, grid->col + 1) - part_start(N, grid->pc, grid->col);
+
+    if (grid->rank) {
+        MPI_Send(C, mloc*nloc, MPI_LONG, 0, TAG, grid->comm);
+        return 1;
+    }
+
+    long* A = create_rect_matrix(M, K);
+    long* B = create_rect_matrix(K, N);
+    long* global_C = create_rect_matrix(M, N);
+    long* block = (long*)malloc(sizeof(long) * (M/grid->pr + 1) * (N/grid->pc + 1));
+    init_rect_matrix(A, M, K, SUMMA_SEED_A);
+    init_rect_matrix(B, K, N, SUMMA_SEED_B);
+
+    for (int r = 0; r < grid->pr; ++r) {
+        for (int c = 0; c < grid->pc; ++c) {
+            const size_t row0 = part_start(M, grid->pr, r), rows = part_start(M, grid->pr, r + 1) - row0;
+            const size_t col0 = part_start(N, grid->pc, c), cols = part_start(N, grid->pc, c + 1) - col0;
+            int source = 0;
+            int coords[2] = {r, c};
+            MPI_Cart_rank(grid->comm, coords, &source);
+
+            if (source == grid->rank) {
+                memcpy(block, C, sizeof(long) * rows*cols);
+            } else {
+                MPI_Recv(block, rows*cols, MPI_LONG, source, TAG, grid->comm, MPI_STATUS_IGNORE);
+            }
+            for (size_t i = 0; i < rows; ++i) {
+                memcpy(&global_C[(row0 + i)*N + col0], &block[i*cols], sizeof(long) * cols);
+            }
+        }
+    }
+
+    int passed = verify_gemm(A, B, global_C, NULL, M, N, K, 1, 0, FREIVALDS_ROUNDS, SUMMA_SEED_A ^ SUMMA_SEED_B);
+    printf("Hash of C: %x\n", hash_rect_matrix(global_C, M, N));
+
+    free(block);
+    delete_rect_matrix(A, M, K);
+    delete_rect_matrix(B, K, N);
+    delete_rect_matrix(global_C, M, N);
+
+    return passed;
+}
+
+void print_usage(const char* prog)
+{
+    fprintf(stderr, "Usage: mpirun -np P %s [options]\n", prog);
+    fprintf(stderr, "  -k, --kernel NAME   local product kernel: naive, transpose, block, packed, simd (default: %s)\n", SUMMA_DEFAULT_KERNEL);
+    fprintf(stderr, "  -n, --dim N|MxNxK   C is MxN, A is MxK (default: %d)\n", SUMMA_DIM);
+    fprintf(stderr, "  -p, --panel N       SUMMA panel width (default: %d)\n", SUMMA_PANEL);
+    fprintf(stderr, "  -t, --threads N     OpenMP threads per rank, enables parallelization if N > 1\n");
+    fprintf(stderr, "  -v, --verify        gather C on rank 0 and check it with Freivalds' algorithm\n");
+    fprintf(stderr, "  -h, --help          show this message\n");
+}
+
+int main(int argc, char** argv)
+{
+    int size = 0, rank = 0;
+    size_t M = SUMMA_DIM, N = SUMMA_DIM, K = SUMMA_DIM;
+    size_t panel_width = SUMMA_PANEL;
+    const char* kernel_name = SUMMA_DEFAULT_KERNEL;
+    int verify = 0;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    static struct option long_options[] = {
+        {"kernel", required_argument, NULL, 'k'},
+        {"dim", required_argument, NULL, 'n'},
+        {"panel", required_argument, NULL, 'p'},
+        {"threads", required_argument, NULL, 't'},
+        {"verify", no_argument, NULL, 'v'},
+        {"help", no_argument, NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "k:n:p:t:vh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'k':
+                kernel_name = optarg;
+                break;
+            case 'n':
+                if (sscanf(optarg, "%zux%zux%zu", &M, &N, &K) != 3) {
+                    M = N = K = strtoul(optarg, NULL, 10);
+                }
+                break;
+            case 'p':
+                panel_width = strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                omp_set_num_threads(atoi(optarg));
+                enable_omp_parallel = atoi(optarg) > 1;
+                break;
+            case 'v':
+                verify = 1;
+                break;
+            case 'h':
+                if (!rank) {
+                    print_usage(argv[0]);
+                }
+                MPI_Finalize();
+                return 0;
+            default:
+                if (!rank) {
+                    print_usage(argv[0]);
+                }
+                MPI_Finalize();
+                return 1;
+        }
+    }
+
+    gemm_t gemm = NULL;
+    for (size_t i = 0; i < num_summa_kernels; ++i) {
+        if (!strcmp(kernel_name, summa_kernels[i].name)) {
+            gemm = summa_kernels[i].gemm;
+        }
+    }
+    if (!gemm || !M || !N || !K || !panel_width) {
+        if (!rank) {
+            fprintf(stderr, "Unknown kernel or bad sizes\n");
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    // As square a grid as the number of ranks allows
+    int dims[2] = {0, 0}, periods[2] = {0, 0}, coords[2] = {0, 0};
+    MPI_Comm grid_comm;
+    MPI_Dims_create(size, 2, dims);
+    MPI_Cart_create(MPI_COMM_WORLD, 2, dims, periods, 0, &grid_comm);
+    MPI_Cart_coords(grid_comm, rank, 2, coords);
+
+    // Without reordering, ranks in grid_comm are the ranks in MPI_COMM_WORLD
+    summa_grid_t grid = {rank, coords[0], coords[1], dims[0], dims[1], grid_comm, MPI_COMM_NULL, MPI_COMM_NULL};
+    int keep_cols[2] = {0, 1}, keep_rows[2] = {1, 0};
+    MPI_Cart_sub(grid_comm, keep_cols, &grid.row_comm);
+    MPI_Cart_sub(grid_comm, keep_rows, &grid.col_comm);
+
+    const size_t row0 = part_start(M, grid.pr, grid.row), mloc = part_start(M, grid.pr, grid.row + 1) - row0;
+    const size_t col0 = part_start(N, grid.pc, grid.col), nloc = part_start(N, grid.pc, grid.col + 1) - col0;
+    const size_t ka0 = part_start(K, grid.pc, grid.col), kloc_a = part_start(K, grid.pc, grid.col + 1) - ka0;
+    const size_t kb0 = part_start(K, grid.pr, grid.row), kloc_b = part_start(K, grid.pr, grid.row + 1) - kb0;
+
+    long* A = (long*)malloc(sizeof(long) * (mloc*kloc_a + 1));
+    long* B = (long*)malloc(sizeof(long) * (kloc_b*nloc + 1));
+    long* C = (long*)malloc(sizeof(long) * (mloc*nloc + 1));
+    init_block(A, mloc, kloc_a, row0, ka0, K, SUMMA_SEED_A);
+    init_block(B, kloc_b, nloc, kb0, col0, N, SUMMA_SEED_B);
+
+    if (!rank) {
+        printf("C(%zux%zu) = A(%zux%zu) * B(%zux%zu), %d x %d grid, panel %zu, kernel %s, %d threads per rank\n",
+               M, N, M, K, K, N, grid.pr, grid.pc, panel_width, kernel_name,
+               enable_omp_parallel ? omp_get_max_threads() : 1);
+    }
+
+    summa_times_t times = summa(&grid, gemm, M, N, K, panel_width, A, B, C);
+
+    // Rank 0 prints every rank's split between local products and waiting for panels
+    double local[3] = {times.compute, times.comm, times.total};
+    double* all = rank ? NULL : (double*)malloc(sizeof(double) * 3 * size);
+    MPI_Gather(local, 3, MPI_DOUBLE, all, 3, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+    if (!rank) {
+        double slowest = 0;
+        printf("\n%-6s %8s %12s %12s %12s %12s\n", "rank", "grid", "block", "compute", "comm", "total");
+        for (int r = 0; r < size; ++r) {
+            int rc[2] = {0, 0};
+            MPI_Cart_coords(grid_comm, r, 2, rc);
+            size_t rows = part_start(M, grid.pr, rc[0] + 1) - part_start(M, grid.pr, rc[0]);
+            size_t cols = part_start(N, grid.pc, rc[1] + 1) - part_start(N, grid.pc, rc[1]);
+            char pos[32] = "", block[32] = "";
+            snprintf(pos, sizeof(pos), "(%d,%d)", rc[0], rc[1]);
+            snprintf(block, sizeof(block), "%zux%zu", rows, cols);
+            printf("%-6d %8s %12s %12lf %12lf %12lf\n", r, pos, block, all[3*r], all[3*r + 1], all[3*r + 2]);
+            slowest = (all[3*r + 2] > slowest) ? all[3*r + 2] : slowest;
+        }
+        printf("\nCalculation time: %lf (%.2lf GOP/s)\n", slowest, 2.0 * M * N * K / slowest / 1e9);
+        free(all);
+    }
+
+    if (verify) {
+        int passed = verify_summa(&grid, M, N, K, C);
+        if (!rank) {
+            printf("Verification: %s\n", passed ? "ok" : "FAILED");
+        }
+    }
+
+    free(A);
+    free(B);
+    free(C);
+    MPI_Comm_free(&grid.row_comm);
+    MPI_Comm_free(&grid.col_comm);
+    MPI_Comm_free(&grid_comm);
+    MPI_Finalize();
+    return 0;
+}
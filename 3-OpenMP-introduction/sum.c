@@ -1,6 +1,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <omp.h>
+#include "../4-OpenMP-additional/perf-tools.h"
+#include "../4-OpenMP-additional/bench-tools.h"
 
 int main(int argc, char** argv)
 {
@@ -12,11 +14,32 @@ int main(int argc, char** argv)
     printf("Calculating sum of (1/n) from 1 to N=%lu\n", N);
 
     long double result = 0;
-    #pragma omp parallel for reduction(+:result)
-        for (unsigned long n = 1; n < N; n++) {
-            result += 1.0/n;
+    bench_t bench;
+    bench_init(&bench, "sum");
+    bench_set(&bench, "n", "%lu", N);
+
+    perf_region_t perf;
+    perf_region_begin(&perf, "sum");
+    perf_region_pause(&perf);
+    for (bench_start(&bench, "sum %lu", N); bench_running(&bench); ) {
+        result = 0;
+        if (bench_timed(&bench)) {
+            perf_region_resume(&perf);
         }
+        bench_tic(&bench);
+        #pragma omp parallel for reduction(+:result)
+            for (unsigned long n = 1; n < N; n++) {
+                result += 1.0/n;
+            }
+        bench_toc(&bench);
+        perf_region_pause(&perf);
+    }
+    perf_region_end(&perf);
+    bench_report(&bench, 2.0 * N, N, 0);
 
+    printf("Calculation time: ");
+    bench_print_times(&bench);
+    printf("\n");
     printf("Result: %Lf\n", result);
 
     return 0;
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "random-tools.h"
+#include "memory-tools.h"
+#include "dataset-tools.h"
+
+enum {
+        ARR_ELEM_MAX = 100
+    };
+
+long* create_array(size_t len)
+{
+    return (long*)create_buffer(sizeof(long)*len);
+}
+
+void delete_array(long* arr, size_t len)
+{
+    delete_buffer(arr, sizeof(long)*len);
+}
+
+void init_array(long* arr, size_t len, unsigned int seed)
+{
+    fill_random(arr, len, seed, ARR_ELEM_MAX);
+}
+
+void _init_array_elements(void* data, size_t len, unsigned int seed)
+{
+    fill_random((long*)data, len, seed, ARR_ELEM_MAX);
+}
+
+// Same contents as create_array() + init_array(), but cached in a dataset file.
+// Sorting writes to the array, so it is mapped copy-on-write.
+long* open_array(const char* path, size_t len, unsigned int seed)
+{
+    return (long*)open_dataset(path, 1, len, DATASET_I64, sizeof(long), seed, 1, _init_array_elements);
+}
+
+void close_array(long* arr, size_t len)
+{
+    unmap_dataset(arr, sizeof(long)*len);
+}
+
+int is_sorted(long *array, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+        if (array[i - 1] > array[i]) return 0;
+    }
+    return 1;
+}
+
+typedef struct {
+    uint64_t sum;
+    uint64_t xor;
+} array_digest_t;
+
+// Order-independent digest of the elements: a sort that drops, duplicates or
+// changes keys gives a different one, a permutation the same
+array_digest_t array_digest(const long* array, size_t n)
+{
+    uint64_t sum = 0, xor = 0;
+
+    #pragma omp parallel for schedule(static) reduction(+: sum) reduction(^: xor)
+    for (size_t i = 0; i < n; ++i) {
+        const uint64_t h = splitmix64((uint64_t)array[i]);
+        sum += h;
+        xor ^= h;
+    }
+
+    array_digest_t digest = {sum, xor};
+    return digest;
+}
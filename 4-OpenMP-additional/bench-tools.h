@@ -0,0 +1,356 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef _OPENMP
+    #include <omp.h>
+#endif
+
+/*
+    Benchmark harness shared by all programs. A measured region runs
+    BENCH_WARMUP untimed times and then BENCH_REPS timed ones:
+
+        bench_start(&bench, "simd 1024");
+        while (bench_running(&bench)) {
+            memset(C, 0, ...);          // per-repetition setup, not timed
+            bench_tic(&bench);
+            simd_mul_matrix(A, B, C, dim);
+            bench_toc(&bench);
+        }
+        bench_report(&bench, 2.0*dim*dim*dim, dim*dim, 3.0*sizeof(long)*dim*dim);
+
+    Times measured elsewhere (e.g. OpenCL event profiling) go in with
+    bench_record() instead of bench_tic()/bench_toc(). Programs print their
+    usual output from the statistics; with BENCH_FORMAT=json or csv every
+    report also emits a record with the statistics, derived throughputs and
+    the configuration (program, CPU, threads, compiler, build flags and
+    whatever the program adds with bench_set()), appended to BENCH_OUTPUT or
+    printed to stderr, so stdout keeps only the human-readable output.
+    BENCH_WARMUP and BENCH_REPS override the defaults.
+*/
+
+#ifndef BENCH_WARMUP
+    #define BENCH_WARMUP 1
+#endif
+#ifndef BENCH_REPS
+    #define BENCH_REPS 5
+#endif
+// Build flags recorded with every result, Makefiles pass them with -DBENCH_BUILD_FLAGS='"$(CFLAGS)"'
+#ifndef BENCH_BUILD_FLAGS
+    #define BENCH_BUILD_FLAGS ""
+#endif
+
+enum {
+        BENCH_MAX_REPS = 1000,
+        BENCH_MAX_CONFIG = 32,
+        BENCH_KEY_LEN = 32,
+        BENCH_VALUE_LEN = 256,
+        BENCH_TEXT = 0,
+        BENCH_JSON,
+        BENCH_CSV
+    };
+
+typedef struct {
+    char key[BENCH_KEY_LEN];
+    char value[BENCH_VALUE_LEN];
+} bench_entry_t;
+
+typedef struct {
+    int format;
+    FILE* output;
+    int csv_header;     // the CSV header is already in output
+    int warmup;
+    int reps;
+    size_t num_config;
+    bench_entry_t config[BENCH_MAX_CONFIG];
+
+    // Current region
+    char name[BENCH_VALUE_LEN];
+    int iteration;
+    double tic;
+    double times[BENCH_MAX_REPS];
+    double min, median, mean, stddev;
+} bench_t;
+
+double bench_now()
+{
+    struct timespec ts = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Adds or replaces a configuration entry recorded with every result
+void bench_set(bench_t* bench, const char* key, const char* fmt, ...)
+{
+    bench_entry_t* entry = NULL;
+    for (size_t i = 0; i < bench->num_config && !entry; ++i) {
+        if (!strcmp(bench->config[i].key, key)) {
+            entry = &bench->config[i];
+        }
+    }
+    if (!entry) {
+        if (bench->num_config == BENCH_MAX_CONFIG) {
+            return;
+        }
+        entry = &bench->config[bench->num_config++];
+        snprintf(entry->key, sizeof(entry->key), "%s", key);
+    }
+
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(entry->value, sizeof(entry->value), fmt, args);
+    va_end(args);
+}
+
+// Value of a configuration entry, "" if there is none
+const char* bench_get(const bench_t* bench, const char* key)
+{
+    for (size_t i = 0; i < bench->num_config; ++i) {
+        if (!strcmp(bench->config[i].key, key)) {
+            return bench->config[i].value;
+        }
+    }
+
+    return "";
+}
+
+void _bench_cpu_model(char* model, size_t size)
+{
+    char line[256] = "";
+    snprintf(model, size, "unknown");
+
+    FILE* file = fopen("/proc/cpuinfo", "r");
+    while (file && fgets(line, sizeof(line), file)) {
+        char* value = strchr(line, ':');
+        if (!strncmp(line, "model name", strlen("model name")) && value) {
+            snprintf(model, size, "%s", value + 2);
+            model[strcspn(model, "\n")] = '\0';
+            break;
+        }
+    }
+    if (file) {
+        fclose(file);
+    }
+}
+
+int _bench_env_int(const char* name, int fallback)
+{
+    const char* env = getenv(name);
+
+    return (env && *env) ? atoi(env) : fallback;
+}
+
+void bench_init(bench_t* bench, const char* program)
+{
+    char model[BENCH_VALUE_LEN] = "";
+
+    memset(bench, 0, sizeof(*bench));
+    bench->output = stderr;
+    bench->warmup = _bench_env_int("BENCH_WARMUP", BENCH_WARMUP);
+    bench->reps = _bench_env_int("BENCH_REPS", BENCH_REPS);
+    bench->warmup = (bench->warmup < 0) ? 0 : bench->warmup;
+    bench->reps = (bench->reps < 1) ? 1 : (bench->reps > BENCH_MAX_REPS) ? BENCH_MAX_REPS : bench->reps;
+
+    const char* format = getenv("BENCH_FORMAT");
+    if (format && !strcmp(format, "json")) {
+        bench->format = BENCH_JSON;
+    } else if (format && !strcmp(format, "csv")) {
+        bench->format = BENCH_CSV;
+    } else if (format && *format && strcmp(format, "text")) {
+        fprintf(stderr, "Unknown BENCH_FORMAT: %s (use text, json or csv)\n", format);
+    }
+
+    const char* path = getenv("BENCH_OUTPUT");
+    if (bench->format != BENCH_TEXT && path && *path) {
+        bench->output = fopen(path, "a");
+        if (!bench->output) {
+            perror("fopen");
+            bench->output = stderr;
+        }
+    }
+    // Appending to a file that already has records, its header is there
+    if (bench->output != stderr && !fseek(bench->output, 0, SEEK_END) && ftell(bench->output) > 0) {
+        bench->csv_header = 1;
+    }
+
+    _bench_cpu_model(model, sizeof(model));
+    bench_set(bench, "program", "%s", program);
+    bench_set(bench, "cpu", "%s", model);
+    bench_set(bench, "cpus", "%ld", sysconf(_SC_NPROCESSORS_ONLN));
+#ifdef _OPENMP
+    bench_set(bench, "threads", "%d", omp_get_max_threads());
+#endif
+#ifdef __VERSION__
+    bench_set(bench, "compiler", "%s", __VERSION__);
+#endif
+    bench_set(bench, "flags", "%s", BENCH_BUILD_FLAGS);
+    bench_set(bench, "warmup", "%d", bench->warmup);
+    bench_set(bench, "reps", "%d", bench->reps);
+}
+
+void bench_start(bench_t* bench, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(bench->name, sizeof(bench->name), fmt, args);
+    va_end(args);
+
+    bench->iteration = 0;
+}
+
+int bench_running(const bench_t* bench)
+{
+    return bench->iteration < bench->warmup + bench->reps;
+}
+
+// Whether the coming repetition is timed rather than a warmup
+int bench_timed(const bench_t* bench)
+{
+    return bench->iteration >= bench->warmup;
+}
+
+// Ends one repetition that took seconds, warmup repetitions are dropped
+void bench_record(bench_t* bench, double seconds)
+{
+    if (bench->iteration >= bench->warmup) {
+        bench->times[bench->iteration - bench->warmup] = seconds;
+    }
+    ++bench->iteration;
+}
+
+void bench_tic(bench_t* bench)
+{
+    bench->tic = bench_now();
+}
+
+void bench_toc(bench_t* bench)
+{
+    bench_record(bench, bench_now() - bench->tic);
+}
+
+int _bench_compare(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+// Statistics of the timed repetitions, returns the median
+double bench_stats(bench_t* bench)
+{
+    const int n = bench->iteration - bench->warmup;
+    double sorted[BENCH_MAX_REPS];
+
+    if (n <= 0) {
+        bench->min = bench->median = bench->mean = bench->stddev = 0;
+        return 0;
+    }
+
+    memcpy(sorted, bench->times, sizeof(double) * n);
+    qsort(sorted, n, sizeof(double), _bench_compare);
+
+    double sum = 0, sq = 0;
+    for (int i = 0; i < n; ++i) {
+        sum += sorted[i];
+    }
+    bench->mean = sum / n;
+    for (int i = 0; i < n; ++i) {
+        sq += (sorted[i] - bench->mean) * (sorted[i] - bench->mean);
+    }
+
+    bench->min = sorted[0];
+    bench->median = (n % 2) ? sorted[n/2] : (sorted[n/2 - 1] + sorted[n/2]) / 2;
+    bench->stddev = (n > 1) ? sqrt(sq / (n - 1)) : 0;
+
+    return bench->median;
+}
+
+// Prints a string as a JSON string or a CSV field
+void _bench_print_string(FILE* out, const char* s, char quote)
+{
+    fputc('"', out);
+    for (; *s; ++s) {
+        if (*s == '"') {
+            fputc(quote, out);
+        } else if (*s == '\\' && quote == '\\') {
+            fputc('\\', out);
+        }
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+void _bench_print_rate(FILE* out, const char* key, double amount, double seconds)
+{
+    if (amount > 0 && seconds > 0) {
+        fprintf(out, ", \"%s\": %.6g", key, amount / seconds);
+    } else {
+        fprintf(out, ", \"%s\": null", key);
+    }
+}
+
+// Computes the statistics and, for json/csv, emits a record. ops, elements and bytes are
+// the work of one repetition, rates are derived from the median, 0 leaves a rate out.
+// Returns the median.
+double bench_report(bench_t* bench, double ops, double elements, double bytes)
+{
+    const int n = bench->iteration - bench->warmup;
+    const double median = bench_stats(bench);
+    FILE* out = bench->output;
+
+    if (bench->format == BENCH_JSON) {
+        fprintf(out, "{\"name\": ");
+        _bench_print_string(out, bench->name, '\\');
+        fprintf(out, ", \"min\": %.9lf, \"median\": %.9lf, \"mean\": %.9lf, \"stddev\": %.9lf",
+                bench->min, bench->median, bench->mean, bench->stddev);
+        _bench_print_rate(out, "gops", ops / 1e9, median);
+        _bench_print_rate(out, "elements_per_s", elements, median);
+        _bench_print_rate(out, "gb_per_s", bytes / 1e9, median);
+
+        fprintf(out, ", \"times\": [");
+        for (int i = 0; i < n; ++i) {
+            fprintf(out, "%s%.9lf", i ? ", " : "", bench->times[i]);
+        }
+        fprintf(out, "], \"config\": {");
+        for (size_t i = 0; i < bench->num_config; ++i) {
+            fprintf(out, "%s\"%s\": ", i ? ", " : "", bench->config[i].key);
+            _bench_print_string(out, bench->config[i].value, '\\');
+        }
+        fprintf(out, "}}\n");
+    } else if (bench->format == BENCH_CSV) {
+        // Header only once per file, so runs can append to the same one
+        if (!bench->csv_header) {
+            fprintf(out, "name,min,median,mean,stddev,gops,elements_per_s,gb_per_s,config\n");
+            bench->csv_header = 1;
+        }
+        _bench_print_string(out, bench->name, '"');
+        fprintf(out, ",%.9lf,%.9lf,%.9lf,%.9lf,%.6g,%.6g,%.6g,", bench->min, bench->median, bench->mean,
+                bench->stddev, median > 0 ? ops / 1e9 / median : 0, median > 0 ? elements / median : 0,
+                median > 0 ? bytes / 1e9 / median : 0);
+
+        char config[BENCH_MAX_CONFIG * (BENCH_KEY_LEN + BENCH_VALUE_LEN)] = "";
+        size_t len = 0;
+        for (size_t i = 0; i < bench->num_config && len < sizeof(config); ++i) {
+            len += snprintf(config + len, sizeof(config) - len, "%s%s=%s", i ? ";" : "",
+                            bench->config[i].key, bench->config[i].value);
+        }
+        _bench_print_string(out, config, '"');
+        fprintf(out, "\n");
+    }
+    fflush(out);
+
+    return median;
+}
+
+// "median 0.123456 s (min 0.120000, mean 0.124000 +- 0.002000, 5 reps)"
+void bench_print_times(const bench_t* bench)
+{
+    printf("median %lf s (min %lf, mean %lf +- %lf, %d reps)", bench->median, bench->min, bench->mean,
+           bench->stddev, bench->iteration - bench->warmup);
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "random-tools.h"
+
+/*
+    On-disk container for benchmark inputs and results:
+
+        [ dataset_header_t | zero padding up to DATASET_PAYLOAD_OFFSET | payload ]
+
+    The payload is a rows x cols row-major array of one element type and
+    starts on a page boundary, so it can be mapped directly. Inputs are
+    written once and then mapped read-only or copy-on-write by later runs.
+    The same file on another machine gives the same data.
+
+    The checksum is written with the file. Reading the whole payload to
+    check it would undo the zero-copy mapping of large inputs, so opening
+    checks only the header, unless the DATASET_VERIFY environment variable
+    is set.
+*/
+
+#define DATASET_MAGIC "PPDATA01"
+
+enum {
+        DATASET_PAYLOAD_OFFSET = 4096,
+        DATASET_I64 = 0,
+        DATASET_I32,
+        DATASET_I16,
+        DATASET_F32,
+        DATASET_F64
+    };
+
+typedef struct {
+    char magic[8];
+    uint32_t elem_type;
+    uint32_t elem_size;
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t seed;
+    uint64_t checksum;
+} dataset_header_t;
+
+// Order-independent hash of the payload, so it can be computed by many threads
+uint64_t dataset_checksum(const void* data, size_t bytes)
+{
+    const uint64_t* words = (const uint64_t*)data;
+    const size_t num_words = bytes / sizeof(uint64_t);
+    uint64_t sum = 0;
+
+    #pragma omp parallel for reduction(+: sum) schedule(static)
+    for (size_t i = 0; i < num_words; ++i) {
+        sum += splitmix64(words[i] + i*SPLITMIX64_GAMMA);
+    }
+
+    uint64_t tail = 0;
+    memcpy(&tail, (const char*)data + num_words*sizeof(uint64_t), bytes % sizeof(uint64_t));
+
+    return sum + splitmix64(tail + num_words*SPLITMIX64_GAMMA);
+}
+
+size_t dataset_bytes(const dataset_header_t* header)
+{
+    return header->rows * header->cols * header->elem_size;
+}
+
+// Writes data to path, returns 0 on success
+int save_dataset(const char* path, const void* data, size_t rows, size_t cols, uint32_t elem_type, uint32_t elem_size, uint64_t seed)
+{
+    dataset_header_t header = {DATASET_MAGIC, elem_type, elem_size, rows, cols, seed, 0};
+    char page[DATASET_PAYLOAD_OFFSET] = {0};
+
+    header.checksum = dataset_checksum(data, dataset_bytes(&header));
+    memcpy(page, &header, sizeof(header));
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        perror("fopen");
+        return -1;
+    }
+
+    int err = fwrite(page, sizeof(page), 1, file) != 1;
+    err |= fwrite(data, 1, dataset_bytes(&header), file) != dataset_bytes(&header);
+    err |= fclose(file) != 0;
+    if (err) {
+        perror("fwrite");
+        return -1;
+    }
+
+    return 0;
+}
+
+// Maps the payload of path. With writable set the mapping is private: writes go to
+// copy-on-write pages and never reach the file. Returns NULL if the file is missing
+// or not a dataset.
+void* map_dataset(const char* path, dataset_header_t* header, int writable)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st = {0};
+    if (fstat(fd, &st) || read(fd, header, sizeof(*header)) != sizeof(*header) ||
+            memcmp(header->magic, DATASET_MAGIC, sizeof(header->magic)) ||
+            (size_t)st.st_size < DATASET_PAYLOAD_OFFSET + dataset_bytes(header)) {
+        close(fd);
+        return NULL;
+    }
+
+    const int prot_flags = writable ? PROT_READ|PROT_WRITE : PROT_READ;
+    const int map_flags = writable ? MAP_PRIVATE : MAP_SHARED;
+    void* ptr = mmap(NULL, DATASET_PAYLOAD_OFFSET + dataset_bytes(header), prot_flags, map_flags, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    return (char*)ptr + DATASET_PAYLOAD_OFFSET;
+}
+
+void unmap_dataset(void* payload, size_t bytes)
+{
+    munmap((char*)payload - DATASET_PAYLOAD_OFFSET, DATASET_PAYLOAD_OFFSET + bytes);
+}
+
+// Whether open_dataset() reads the whole payload to check its checksum
+int dataset_verify_enabled()
+{
+    const char* env = getenv("DATASET_VERIFY");
+
+    return env && *env && strcmp(env, "0");
+}
+
+// Maps a rows x cols dataset from path, (re)creating the file with init() first if it is
+// missing or has a different shape, type or seed, or fails its checksum under DATASET_VERIFY
+void* open_dataset(const char* path, size_t rows, size_t cols, uint32_t elem_type, uint32_t elem_size,
+                   uint64_t seed, int writable, void (*init)(void* data, size_t len, unsigned int seed))
+{
+    dataset_header_t header = {{0}, 0, 0, 0, 0, 0, 0};
+    void* data = map_dataset(path, &header, writable);
+
+    if (data) {
+        if (header.rows == rows && header.cols == cols && header.elem_type == elem_type &&
+                header.elem_size == elem_size && header.seed == seed &&
+                (!dataset_verify_enabled() || dataset_checksum(data, dataset_bytes(&header)) == header.checksum)) {
+            printf("Loaded %s\n", path);
+            return data;
+        }
+
+        fprintf(stderr, "%s does not match, regenerating it\n", path);
+        unmap_dataset(data, dataset_bytes(&header));
+    }
+
+    size_t bytes = rows * cols * elem_size;
+    void* buffer = malloc(bytes);
+    if (!buffer) {
+        perror("malloc");
+        return NULL;
+    }
+
+    init(buffer, rows * cols, seed);
+    int err = save_dataset(path, buffer, rows, cols, elem_type, elem_size, seed);
+    free(buffer);
+    if (err) {
+        return NULL;
+    }
+
+    printf("Generated %s\n", path);
+    return map_dataset(path, &header, writable);
+}
@@ -2,71 +2,67 @@
 #include <stdlib.h>
 #include <sys/mman.h>
 #include <omp.h>
+#include "../array-tools.h"
+#include "../bench-tools.h"
 
 // Defauilt is ~13.6GB when used with int64
 #ifndef ARR_LEN
     #define ARR_LEN 1700000000
 #endif
 
-enum {
-        ARR_ELEM_MAX = 100
-    };
-
-long* create_array(size_t len)
-{
-    const int prot_flags = PROT_READ|PROT_WRITE;
-    const int map_flags = MAP_PRIVATE|MAP_ANON;
-    void* ptr = mmap(NULL, sizeof(long)*len, prot_flags, map_flags, -1, 0);
-    if(ptr == MAP_FAILED) {
-        perror("mmap");
-        return NULL;
-    }
-
-    return (long*)ptr;
-}
-
-void delete_array(long* arr, size_t len)
-{
-    munmap(arr, sizeof(long)*len);
-}
-
-void init_array(long* arr, size_t len, unsigned int seed)
-{
-    srand(seed);
-
-    for (size_t i = 0; i < len; ++i) {
-        arr[i] = rand() % ARR_ELEM_MAX;
-    }
-}
-
 int main()
 {
     long* array = create_array(ARR_LEN);
     init_array(array, ARR_LEN, 0xA77);
+    print_memory_policy();
+
+    bench_t bench;
+    bench_init(&bench, "offload-avg");
+    bench_set(&bench, "length", "%d", ARR_LEN);
 
-    #pragma omp target map(to: array[:ARR_LEN])
+    // The array is copied to the device once, every repetition is a target region
+    // timed on the device, so the times do not include the transfer
+    #pragma omp target data map(to: array[:ARR_LEN])
     {
-        if (omp_is_initial_device()) {
-            printf("Running on host\n");
-        } else {
-            printf("Running on target\n");
+        int on_host = 1, threads = 0;
+        #pragma omp target map(from: on_host, threads)
+        {
+            on_host = omp_is_initial_device();
+            threads = omp_get_max_threads();
         }
-        printf("Available number of threads: %d\n", omp_get_max_threads());
+        printf(on_host ? "Running on host\n" : "Running on target\n");
+        printf("Available number of threads: %d\n", threads);
+        bench_set(&bench, "device", "%s", on_host ? "host" : "target");
+        bench_set(&bench, "device_threads", "%d", threads);
 
-        double start = omp_get_wtime();
+        double res = 0;
+        for (bench_start(&bench, "avg %d", ARR_LEN); bench_running(&bench); ) {
+            double time = 0;
+            long sum = 0;
 
-        long sum = 0;
-        #pragma omp parallel for reduction(+: sum)
-        for (size_t i = 0; i < ARR_LEN; ++i) {
-            sum += array[i];
-        }
+            #pragma omp target map(from: time, sum)
+            {
+                double start = omp_get_wtime();
+
+                long s = 0;
+                #pragma omp parallel for reduction(+: s)
+                for (size_t i = 0; i < ARR_LEN; ++i) {
+                    s += array[i];
+                }
+                sum = s;
 
-        double res = (double)sum/ARR_LEN;
+                time = omp_get_wtime() - start;
+            }
 
-        double end = omp_get_wtime();
+            bench_record(&bench, time);
+            res = (double)sum/ARR_LEN;
+        }
+        bench_report(&bench, ARR_LEN, ARR_LEN, (double)sizeof(long) * ARR_LEN);
 
         printf("\n");
-        printf("Calculation time: %lf\n", end - start);
+        printf("Calculation time: ");
+        bench_print_times(&bench);
+        printf("\n");
         printf("Result: avg=%f\n", res);
     }
 
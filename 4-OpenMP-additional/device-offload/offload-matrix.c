@@ -7,6 +7,9 @@
 #ifndef MATRIX_MUL_BS
     #define MATRIX_MUL_BS 2
 #endif
+#ifndef FREIVALDS_ROUNDS
+    #define FREIVALDS_ROUNDS 2
+#endif
 
 void target_mul_matrix(long* A, long* B, long* C, size_t dim)
 {
@@ -63,6 +66,7 @@ int main()
 
     init_matrix(A, MATRIX_DIM, 0xA);
     init_matrix(B, MATRIX_DIM, 0xB);
+    print_memory_policy();
 
     const size_t msize = MATRIX_DIM*MATRIX_DIM;
     double start = 0, end = 0;
@@ -89,4 +93,10 @@ int main()
     printf("hash(A) = %x\n", hash_matrix(A, MATRIX_DIM));
     printf("hash(B) = %x\n", hash_matrix(B, MATRIX_DIM));
     printf("hash(C) = %x\n", hash_matrix(C, MATRIX_DIM));
+
+    if (verify_matrix(A, B, C, MATRIX_DIM, FREIVALDS_ROUNDS, 0xF)) {
+        printf("Result verified.\n");
+    } else {
+        printf("Result is WRONG!\n");
+    }
 }
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+/*
+    Batched multiplication of many small independent matrices, C[b] += A[b]*B[b].
+    The batch is split between threads once, so there is no per-matrix parallel
+    region, and common sizes get kernels with the size known at compile time.
+
+    Two layouts:
+
+        contiguous   matrix b occupies elements [b*dim*dim, (b + 1)*dim*dim)
+        interleaved  groups of MATRIX_BATCH_LANES matrices, element (i, j) of
+                     all matrices of a group stored next to each other:
+                     group*dim*dim*LANES + (i*dim + j)*LANES + lane
+
+    In the interleaved layout one vector holds the same element of LANES
+    matrices, so the kernel vectorizes across matrices and needs neither
+    broadcasts nor tails for any dim. Batches are padded with zero matrices
+    to whole groups.
+*/
+
+// 8 longs fill one AVX-512 vector
+#ifndef MATRIX_BATCH_LANES
+    #define MATRIX_BATCH_LANES 8
+#endif
+
+extern int enable_omp_parallel;
+
+typedef struct {
+    size_t dim;
+    void (*mul)(long* A, long* B, long* C, size_t dim);
+    void (*interleaved_mul)(long* A, long* B, long* C, size_t dim);
+} batch_kernel_t;
+
+// N is either a literal (specialized kernels) or dim (generic kernels)
+#define DEFINE_BATCH_KERNELS(SFX, N)                                                               \
+    __attribute__((target_clones("arch=skylake-avx512", "avx2", "default")))                       \
+    void _batch_mul_##SFX(long* restrict A, long* restrict B, long* restrict C, size_t dim)        \
+    {                                                                                              \
+        const size_t n = N;                                                                        \
+        (void)dim;                                                                                 \
+                                                                                                   \
+        for (size_t i = 0; i < n; ++i) {                                                           \
+            for (size_t p = 0; p < n; ++p) {                                                       \
+                long a = A[i*n + p];                                                               \
+                for (size_t j = 0; j < n; ++j) {                                                   \
+                    C[i*n + j] += a * B[p*n + j];                                                  \
+                }                                                                                  \
+            }                                                                                      \
+        }                                                                                          \
+    }                                                                                              \
+                                                                                                   \
+    __attribute__((target_clones("arch=skylake-avx512", "avx2", "default")))                       \
+    void _interleaved_mul_##SFX(long* restrict A, long* restrict B, long* restrict C, size_t dim)  \
+    {                                                                                              \
+        const size_t n = N;                                                                        \
+        const size_t L = MATRIX_BATCH_LANES;                                                       \
+        (void)dim;                                                                                 \
+                                                                                                   \
+        for (size_t i = 0; i < n; ++i) {                                                           \
+            for (size_t p = 0; p < n; ++p) {                                                       \
+                long* a = &A[(i*n + p)*L];                                                         \
+                for (size_t j = 0; j < n; ++j) {                                                   \
+                    for (size_t l = 0; l < L; ++l) {                                               \
+                        C[(i*n + j)*L + l] += a[l] * B[(p*n + j)*L + l];                           \
+                    }                                                                              \
+                }                                                                                  \
+            }                                                                                      \
+        }                                                                                          \
+    }
+
+DEFINE_BATCH_KERNELS(8, 8)
+DEFINE_BATCH_KERNELS(16, 16)
+DEFINE_BATCH_KERNELS(32, 32)
+DEFINE_BATCH_KERNELS(64, 64)
+DEFINE_BATCH_KERNELS(any, dim)
+
+const batch_kernel_t batch_kernels[] = {
+    {8, _batch_mul_8, _interleaved_mul_8},
+    {16, _batch_mul_16, _interleaved_mul_16},
+    {32, _batch_mul_32, _interleaved_mul_32},
+    {64, _batch_mul_64, _interleaved_mul_64},
+};
+
+const batch_kernel_t batch_kernel_any = {0, _batch_mul_any, _interleaved_mul_any};
+
+// Specialized kernel for dim if there is one, the generic one otherwise
+const batch_kernel_t* select_batch_kernel(size_t dim)
+{
+    for (size_t i = 0; i < sizeof(batch_kernels)/sizeof(batch_kernels[0]); ++i) {
+        if (batch_kernels[i].dim == dim) {
+            return &batch_kernels[i];
+        }
+    }
+
+    return &batch_kernel_any;
+}
+
+// Number of elements of an interleaved batch, including padding matrices
+size_t interleaved_batch_len(size_t count, size_t dim)
+{
+    const size_t groups = (count + MATRIX_BATCH_LANES - 1) / MATRIX_BATCH_LANES;
+
+    return groups * MATRIX_BATCH_LANES * dim*dim;
+}
+
+// Converts count contiguous matrices into the interleaved layout, padding included
+void interleave_batch(long* src, long* dst, size_t count, size_t dim)
+{
+    const size_t L = MATRIX_BATCH_LANES;
+    const size_t groups = (count + L - 1) / L;
+    const size_t size = dim*dim;
+
+    #pragma omp parallel for if (enable_omp_parallel)
+    for (size_t g = 0; g < groups; ++g) {
+        long* rdst = &dst[g*size*L];
+        for (size_t l = 0; l < L; ++l) {
+            size_t b = g*L + l;
+            for (size_t e = 0; e < size; ++e) {
+                rdst[e*L + l] = (b < count) ? src[b*size + e] : 0;
+            }
+        }
+    }
+}
+
+void deinterleave_batch(long* src, long* dst, size_t count, size_t dim)
+{
+    const size_t L = MATRIX_BATCH_LANES;
+    const size_t size = dim*dim;
+
+    #pragma omp parallel for if (enable_omp_parallel)
+    for (size_t b = 0; b < count; ++b) {
+        long* rsrc = &src[(b / L)*size*L + b % L];
+        for (size_t e = 0; e < size; ++e) {
+            dst[b*size + e] = rsrc[e*L];
+        }
+    }
+}
+
+// C[b] += A[b]*B[b] for count contiguous dim x dim matrices
+void batch_mul_matrix(long* A, long* B, long* C, size_t count, size_t dim)
+{
+    const batch_kernel_t* kernel = select_batch_kernel(dim);
+    const size_t size = dim*dim;
+
+    #pragma omp parallel for schedule(static) if (enable_omp_parallel)
+    for (size_t b = 0; b < count; ++b) {
+        kernel->mul(&A[b*size], &B[b*size], &C[b*size], dim);
+    }
+}
+
+// Same on interleaved batches of interleaved_batch_len(count, dim) elements
+void interleaved_batch_mul_matrix(long* A, long* B, long* C, size_t count, size_t dim)
+{
+    const batch_kernel_t* kernel = select_batch_kernel(dim);
+    const size_t groups = (count + MATRIX_BATCH_LANES - 1) / MATRIX_BATCH_LANES;
+    const size_t group_len = MATRIX_BATCH_LANES * dim*dim;
+
+    #pragma omp parallel for schedule(static) if (enable_omp_parallel)
+    for (size_t g = 0; g < groups; ++g) {
+        kernel->interleaved_mul(&A[g*group_len], &B[g*group_len], &C[g*group_len], dim);
+    }
+}
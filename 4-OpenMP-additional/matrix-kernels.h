@@ -0,0 +1,487 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#include <omp.h>
+
+/*
+    Dense long GEMM kernels: naive, transposed, block, packed and simd, each as a
+    BLAS-like *_gemm() and a square *_mul_matrix() wrapper. matrix.c benchmarks
+    them, the MPI distributed multiply uses them for its local products.
+    Parallel regions are enabled by enable_omp_parallel (-DPARALLEL).
+*/
+
+#ifndef MATRIX_MUL_BS
+    #define MATRIX_MUL_BS 512
+#endif
+
+// Packed GEMM tiling: KC x NR panel of B stays in L1, MC x KC block of A in L2,
+// KC x NC panel of B in L3. MR x NR is the register tile of the micro-kernel.
+#ifndef MATRIX_PACK_MC
+    #define MATRIX_PACK_MC 128
+#endif
+#ifndef MATRIX_PACK_KC
+    #define MATRIX_PACK_KC 256
+#endif
+#ifndef MATRIX_PACK_NC
+    #define MATRIX_PACK_NC 4096
+#endif
+#define MATRIX_PACK_MR 4
+#define MATRIX_PACK_NR 8
+
+#ifdef PARALLEL
+    int enable_omp_parallel = 1;
+#else
+    int enable_omp_parallel = 0;
+#endif
+
+// Compile-time default, can be overridden by the tune cache and then from the command line
+size_t matrix_mul_bs = MATRIX_MUL_BS;
+
+// The long kernels compute C = alpha*A*B + beta*C for an m x k A, a k x n B and an m x n C,
+// all row-major with leading dimensions lda, ldb, ldc (BLAS GEMM without transposes).
+// The square entry points are thin wrappers that compute C += A*B.
+typedef void (*gemm_t)(size_t m, size_t n, size_t k, long alpha, long* A, size_t lda, long* B, size_t ldb, long beta, long* C, size_t ldc);
+
+// C = beta*C, done up front so that kernels only accumulate. C is not read if beta is 0.
+void _scale_matrix(size_t m, size_t n, long beta, long* C, size_t ldc)
+{
+    if (beta == 1) {
+        return;
+    }
+
+    #pragma omp parallel for if (enable_omp_parallel)
+        for (size_t i = 0; i < m; ++i) {
+            for (size_t j = 0; j < n; ++j) {
+                C[i*ldc + j] = beta ? beta * C[i*ldc + j] : 0;
+            }
+        }
+}
+
+void naive_gemm(size_t m, size_t n, size_t k, long alpha, long* A, size_t lda, long* B, size_t ldb, long beta, long* C, size_t ldc)
+{
+    _scale_matrix(m, n, beta, C, ldc);
+
+    #pragma omp parallel for if (enable_omp_parallel)
+        for (size_t i = 0; i < m; ++i) {
+            for (size_t j = 0; j < n; ++j) {
+                long sum = 0;
+                for (size_t p = 0; p < k; ++p) {
+                    sum += A[i*lda + p] * B[p*ldb + j];
+                }
+
+                C[i*ldc + j] += alpha * sum;
+            }
+        }
+}
+
+void mul_matrix(long* A, long* B, long* C, size_t dim)
+{
+    naive_gemm(dim, dim, dim, 1, A, dim, B, dim, 1, C, dim);
+}
+
+void transposed_gemm(size_t m, size_t n, size_t k, long alpha, long* A, size_t lda, long* B, size_t ldb, long beta, long* C, size_t ldc)
+{
+    _scale_matrix(m, n, beta, C, ldc);
+
+    #pragma omp parallel for if (enable_omp_parallel)
+        for (size_t i = 0; i < m; ++i) {
+            for (size_t p = 0; p < k; ++p) {
+                long a = alpha * A[i*lda + p];
+                for (size_t j = 0; j < n; ++j) {
+                    C[i*ldc + j] += a * B[p*ldb + j];
+                }
+            }
+        }
+}
+
+void transposed_mul_matrix(long* A, long* B, long* C, size_t dim)
+{
+    transposed_gemm(dim, dim, dim, 1, A, dim, B, dim, 1, C, dim);
+}
+
+// Edge blocks are cut to the remaining rows, columns and depth
+void block_gemm(size_t m, size_t n, size_t k, long alpha, long* A, size_t lda, long* B, size_t ldb, long beta, long* C, size_t ldc)
+{
+    size_t bs = matrix_mul_bs;
+
+    _scale_matrix(m, n, beta, C, ldc);
+
+    #pragma omp parallel for if (enable_omp_parallel)
+        for (size_t i = 0; i < m; i += bs) {
+            size_t mb = (m - i < bs) ? m - i : bs;
+
+            for (size_t j = 0; j < n; j += bs) {
+                size_t nb = (n - j < bs) ? n - j : bs;
+
+                for (size_t p = 0; p < k; p += bs) {
+                    size_t kb = (k - p < bs) ? k - p : bs;
+
+                    long* rC = &C[i*ldc + j];
+                    long* rA = &A[i*lda + p];
+                    for (size_t i2 = 0; i2 < mb; ++i2) {
+
+                        long* rB = &B[p*ldb + j];
+                        for (size_t k2 = 0; k2 < kb; ++k2) {
+                            long a = alpha * rA[k2];
+                            for (size_t j2 = 0; j2 < nb; ++j2) {
+                                rC[j2] += a * rB[j2];
+                            }
+
+                            rB += ldb;
+                        }
+
+                        rC += ldc;
+                        rA += lda;
+                    }
+                }
+            }
+        }
+}
+
+void block_mul_matrix(long* A, long* B, long* C, size_t dim)
+{
+    block_gemm(dim, dim, dim, 1, A, dim, B, dim, 1, C, dim);
+}
+
+// Copies mc x kc block of A into MR-row panels, each stored column by column.
+// Rows past mc are zero-padded, so the micro-kernel never needs edge checks.
+void _pack_matrix_a(long* A, size_t lda, long* Ap, size_t mc, size_t kc)
+{
+    const size_t mr = MATRIX_PACK_MR;
+
+    for (size_t i = 0; i < mc; i += mr) {
+        for (size_t p = 0; p < kc; ++p) {
+            for (size_t i2 = 0; i2 < mr; ++i2) {
+                *Ap++ = (i + i2 < mc) ? A[(i + i2)*lda + p] : 0;
+            }
+        }
+    }
+}
+
+// Copies kc x nc panel of B into NR-column slivers, each stored row by row.
+void _pack_matrix_b(long* B, size_t ldb, long* Bp, size_t kc, size_t nc)
+{
+    const size_t nr = MATRIX_PACK_NR;
+
+    #pragma omp for
+    for (size_t j = 0; j < nc; j += nr) {
+        long* rBp = &Bp[j*kc];
+        for (size_t p = 0; p < kc; ++p) {
+            for (size_t j2 = 0; j2 < nr; ++j2) {
+                *rBp++ = (j + j2 < nc) ? B[p*ldb + j + j2] : 0;
+            }
+        }
+    }
+}
+
+// C[0:mr, 0:nr] += alpha * Ap * Bp, accumulating the full MR x NR tile in registers
+void _micro_kernel(long* Ap, long* Bp, long* C, size_t ldc, size_t kc, size_t mr, size_t nr, long alpha)
+{
+    long acc[MATRIX_PACK_MR][MATRIX_PACK_NR] = {{0}};
+
+    for (size_t p = 0; p < kc; ++p) {
+        for (size_t i = 0; i < MATRIX_PACK_MR; ++i) {
+            for (size_t j = 0; j < MATRIX_PACK_NR; ++j) {
+                acc[i][j] += Ap[i] * Bp[j];
+            }
+        }
+
+        Ap += MATRIX_PACK_MR;
+        Bp += MATRIX_PACK_NR;
+    }
+
+    for (size_t i = 0; i < mr; ++i) {
+        for (size_t j = 0; j < nr; ++j) {
+            C[i*ldc + j] += alpha * acc[i][j];
+        }
+    }
+}
+
+void packed_gemm(size_t m, size_t n, size_t k, long alpha, long* A, size_t lda, long* B, size_t ldb, long beta, long* C, size_t ldc)
+{
+    const size_t mc_max = MATRIX_PACK_MC;
+    const size_t kc_max = MATRIX_PACK_KC;
+    const size_t nc_max = MATRIX_PACK_NC;
+    const size_t mr = MATRIX_PACK_MR;
+    const size_t nr = MATRIX_PACK_NR;
+
+    _scale_matrix(m, n, beta, C, ldc);
+
+    // Panel buffers are rounded up to whole register tiles
+    const size_t nc_buf = (nc_max < n ? nc_max : n) + nr;
+    long* Bp = (long*)aligned_alloc(64, sizeof(long) * kc_max * nc_buf);
+    if (!Bp) {
+        perror("aligned_alloc");
+        exit(EXIT_FAILURE);
+    }
+
+    #pragma omp parallel if (enable_omp_parallel)
+    {
+        long* Ap = (long*)aligned_alloc(64, sizeof(long) * (mc_max + mr) * kc_max);
+        if (!Ap) {
+            perror("aligned_alloc");
+            exit(EXIT_FAILURE);
+        }
+
+        for (size_t jc = 0; jc < n; jc += nc_max) {
+            size_t nc = (n - jc < nc_max) ? n - jc : nc_max;
+
+            for (size_t pc = 0; pc < k; pc += kc_max) {
+                size_t kc = (k - pc < kc_max) ? k - pc : kc_max;
+
+                _pack_matrix_b(&B[pc*ldb + jc], ldb, Bp, kc, nc);  // implicit barrier
+
+                #pragma omp for schedule(runtime)
+                for (size_t ic = 0; ic < m; ic += mc_max) {
+                    size_t mc = (m - ic < mc_max) ? m - ic : mc_max;
+
+                    _pack_matrix_a(&A[ic*lda + pc], lda, Ap, mc, kc);
+
+                    for (size_t jr = 0; jr < nc; jr += nr) {
+                        for (size_t ir = 0; ir < mc; ir += mr) {
+                            _micro_kernel(&Ap[ir*kc], &Bp[jr*kc], &C[(ic + ir)*ldc + jc + jr], ldc, kc,
+                                          (mc - ir < mr) ? mc - ir : mr,
+                                          (nc - jr < nr) ? nc - jr : nr, alpha);
+                        }
+                    }
+                }  // implicit barrier: Bp is reused by the next pc iteration
+            }
+        }
+
+        free(Ap);
+    }
+
+    free(Bp);
+}
+
+void packed_mul_matrix(long* A, long* B, long* C, size_t dim)
+{
+    packed_gemm(dim, dim, dim, 1, A, dim, B, dim, 1, C, dim);
+}
+
+// SIMD kernels keep a strip of C columns in vector registers and broadcast alpha*A[i][k],
+// so each output element is accumulated in a lane without horizontal sums.
+// KC bounds the part of the B strip that is reused across the MB rows of a row block.
+// Row blocks and strips are scheduled with schedule(runtime): OMP_SCHEDULE or the tuned
+// schedule, libgomp defaults to dynamic. Columns past the last full strip are done one
+// (masked) vector at a time.
+#ifndef MATRIX_SIMD_KC
+    #define MATRIX_SIMD_KC 256
+#endif
+#ifndef MATRIX_SIMD_MB
+    #define MATRIX_SIMD_MB 256
+#endif
+
+// C[:][j0:j1] += alpha * A * B[:][j0:j1], used as fallback
+void _scalar_mul_strip(size_t m, size_t k, long alpha, long* A, size_t lda, long* B, size_t ldb, long* C, size_t ldc, size_t j0, size_t j1)
+{
+    for (size_t i = 0; i < m; ++i) {
+        for (size_t p = 0; p < k; ++p) {
+            long a = alpha * A[i*lda + p];
+            for (size_t j = j0; j < j1; ++j) {
+                C[i*ldc + j] += a * B[p*ldb + j];
+            }
+        }
+    }
+}
+
+// AVX2 has no 64-bit multiply: combine three 32x32->64 products.
+// a_hi is passed in since A[i][k] is broadcast and its high half is reused.
+__attribute__((target("avx2")))
+inline __m256i __avx2_mullo_epi64(__m256i a, __m256i a_hi, __m256i b)
+{
+    __m256i b_hi = _mm256_srli_epi64(b, 32);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(a_hi, b), _mm256_mul_epu32(a, b_hi));
+
+    return _mm256_add_epi64(_mm256_mul_epu32(a, b), _mm256_slli_epi64(cross, 32));
+}
+
+__attribute__((target("avx2")))
+void _avx2_gemm(size_t m, size_t n, size_t k, long alpha, long* A, size_t lda, long* B, size_t ldb, long beta, long* C, size_t ldc)
+{
+    const size_t sw = 16;  // strip width: 4 vectors of 4 longs
+    const size_t kc_max = MATRIX_SIMD_KC;
+    const size_t mb = MATRIX_SIMD_MB;
+    const size_t n_main = n - n % sw;
+
+    _scale_matrix(m, n, beta, C, ldc);
+
+    #pragma omp parallel for collapse(2) schedule(runtime) if (enable_omp_parallel)
+    for (size_t i0 = 0; i0 < m; i0 += mb) {
+        for (size_t j = 0; j < n_main; j += sw) {
+            size_t iend = (m - i0 < mb) ? m : i0 + mb;
+
+            for (size_t kc = 0; kc < k; kc += kc_max) {
+                size_t kend = (k - kc < kc_max) ? k : kc + kc_max;
+
+                for (size_t i = i0; i < iend; ++i) {
+                    long* rC = &C[i*ldc + j];
+                    __m256i c0 = _mm256_loadu_si256((__m256i*)&rC[0]);
+                    __m256i c1 = _mm256_loadu_si256((__m256i*)&rC[4]);
+                    __m256i c2 = _mm256_loadu_si256((__m256i*)&rC[8]);
+                    __m256i c3 = _mm256_loadu_si256((__m256i*)&rC[12]);
+
+                    for (size_t p = kc; p < kend; ++p) {
+                        long* rB = &B[p*ldb + j];
+                        __m256i a = _mm256_set1_epi64x(alpha * A[i*lda + p]);
+                        __m256i a_hi = _mm256_srli_epi64(a, 32);
+
+                        c0 = _mm256_add_epi64(c0, __avx2_mullo_epi64(a, a_hi, _mm256_loadu_si256((__m256i*)&rB[0])));
+                        c1 = _mm256_add_epi64(c1, __avx2_mullo_epi64(a, a_hi, _mm256_loadu_si256((__m256i*)&rB[4])));
+                        c2 = _mm256_add_epi64(c2, __avx2_mullo_epi64(a, a_hi, _mm256_loadu_si256((__m256i*)&rB[8])));
+                        c3 = _mm256_add_epi64(c3, __avx2_mullo_epi64(a, a_hi, _mm256_loadu_si256((__m256i*)&rB[12])));
+                    }
+
+                    _mm256_storeu_si256((__m256i*)&rC[0], c0);
+                    _mm256_storeu_si256((__m256i*)&rC[4], c1);
+                    _mm256_storeu_si256((__m256i*)&rC[8], c2);
+                    _mm256_storeu_si256((__m256i*)&rC[12], c3);
+                }
+            }
+        }
+    }
+
+    if (n_main == n) {
+        return;
+    }
+
+    #pragma omp parallel for schedule(runtime) if (enable_omp_parallel)
+    for (size_t i0 = 0; i0 < m; i0 += mb) {
+        size_t iend = (m - i0 < mb) ? m : i0 + mb;
+
+        for (size_t j = n_main; j < n; j += 4) {
+            __m256i mask = _mm256_cmpgt_epi64(_mm256_set1_epi64x(n - j), _mm256_setr_epi64x(0, 1, 2, 3));
+
+            for (size_t i = i0; i < iend; ++i) {
+                long long* rC = (long long*)&C[i*ldc + j];
+                __m256i c = _mm256_maskload_epi64(rC, mask);
+
+                for (size_t p = 0; p < k; ++p) {
+                    __m256i a = _mm256_set1_epi64x(alpha * A[i*lda + p]);
+                    __m256i b = _mm256_maskload_epi64((long long*)&B[p*ldb + j], mask);
+
+                    c = _mm256_add_epi64(c, __avx2_mullo_epi64(a, _mm256_srli_epi64(a, 32), b));
+                }
+
+                _mm256_maskstore_epi64(rC, mask, c);
+            }
+        }
+    }
+}
+
+__attribute__((target("avx512f,avx512dq")))
+void _avx512_gemm(size_t m, size_t n, size_t k, long alpha, long* A, size_t lda, long* B, size_t ldb, long beta, long* C, size_t ldc)
+{
+    const size_t sw = 32;  // strip width: 4 vectors of 8 longs
+    const size_t kc_max = MATRIX_SIMD_KC;
+    const size_t mb = MATRIX_SIMD_MB;
+    const size_t n_main = n - n % sw;
+
+    _scale_matrix(m, n, beta, C, ldc);
+
+    #pragma omp parallel for collapse(2) schedule(runtime) if (enable_omp_parallel)
+    for (size_t i0 = 0; i0 < m; i0 += mb) {
+        for (size_t j = 0; j < n_main; j += sw) {
+            size_t iend = (m - i0 < mb) ? m : i0 + mb;
+
+            for (size_t kc = 0; kc < k; kc += kc_max) {
+                size_t kend = (k - kc < kc_max) ? k : kc + kc_max;
+
+                for (size_t i = i0; i < iend; ++i) {
+                    long* rC = &C[i*ldc + j];
+                    __m512i c0 = _mm512_loadu_si512(&rC[0]);
+                    __m512i c1 = _mm512_loadu_si512(&rC[8]);
+                    __m512i c2 = _mm512_loadu_si512(&rC[16]);
+                    __m512i c3 = _mm512_loadu_si512(&rC[24]);
+
+                    for (size_t p = kc; p < kend; ++p) {
+                        long* rB = &B[p*ldb + j];
+                        __m512i a = _mm512_set1_epi64(alpha * A[i*lda + p]);
+
+                        c0 = _mm512_add_epi64(c0, _mm512_mullo_epi64(a, _mm512_loadu_si512(&rB[0])));
+                        c1 = _mm512_add_epi64(c1, _mm512_mullo_epi64(a, _mm512_loadu_si512(&rB[8])));
+                        c2 = _mm512_add_epi64(c2, _mm512_mullo_epi64(a, _mm512_loadu_si512(&rB[16])));
+                        c3 = _mm512_add_epi64(c3, _mm512_mullo_epi64(a, _mm512_loadu_si512(&rB[24])));
+                    }
+
+                    _mm512_storeu_si512(&rC[0], c0);
+                    _mm512_storeu_si512(&rC[8], c1);
+                    _mm512_storeu_si512(&rC[16], c2);
+                    _mm512_storeu_si512(&rC[24], c3);
+                }
+            }
+        }
+    }
+
+    if (n_main == n) {
+        return;
+    }
+
+    #pragma omp parallel for schedule(runtime) if (enable_omp_parallel)
+    for (size_t i0 = 0; i0 < m; i0 += mb) {
+        size_t iend = (m - i0 < mb) ? m : i0 + mb;
+
+        for (size_t j = n_main; j < n; j += 8) {
+            __mmask8 mask = (n - j < 8) ? (__mmask8)((1u << (n - j)) - 1) : 0xFF;
+
+            for (size_t i = i0; i < iend; ++i) {
+                long* rC = &C[i*ldc + j];
+                __m512i c = _mm512_maskz_loadu_epi64(mask, rC);
+
+                for (size_t p = 0; p < k; ++p) {
+                    __m512i a = _mm512_set1_epi64(alpha * A[i*lda + p]);
+
+                    c = _mm512_add_epi64(c, _mm512_mullo_epi64(a, _mm512_maskz_loadu_epi64(mask, &B[p*ldb + j])));
+                }
+
+                _mm512_mask_storeu_epi64(rC, mask, c);
+            }
+        }
+    }
+}
+
+void _scalar_gemm(size_t m, size_t n, size_t k, long alpha, long* A, size_t lda, long* B, size_t ldb, long beta, long* C, size_t ldc)
+{
+    _scale_matrix(m, n, beta, C, ldc);
+    _scalar_mul_strip(m, k, alpha, A, lda, B, ldb, C, ldc, 0, n);
+}
+
+// Picks the widest instruction set supported by the CPU we run on
+const char* simd_isa_name()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")) {
+        return "avx512";
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return "avx2";
+    }
+
+    return "scalar";
+}
+
+gemm_t _select_simd_kernel()
+{
+    const char* isa = simd_isa_name();
+
+    if (!strcmp(isa, "avx512")) {
+        return _avx512_gemm;
+    }
+    if (!strcmp(isa, "avx2")) {
+        return _avx2_gemm;
+    }
+
+    return _scalar_gemm;
+}
+
+void simd_gemm(size_t m, size_t n, size_t k, long alpha, long* A, size_t lda, long* B, size_t ldb, long beta, long* C, size_t ldc)
+{
+    _select_simd_kernel()(m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+void simd_mul_matrix(long* A, long* B, long* C, size_t dim)
+{
+    simd_gemm(dim, dim, dim, 1, A, dim, B, dim, 1, C, dim);
+}
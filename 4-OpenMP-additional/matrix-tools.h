@@ -2,7 +2,21 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
+#include "random-tools.h"
+#include "memory-tools.h"
+#include "dataset-tools.h"
+
+// SIMD transposes are host-only, device passes of offloading compilers skip them
+#if defined(__x86_64__) && !defined(__AMDGCN__) && !defined(__NVPTX__)
+    #include <immintrin.h>
+    #define MATRIX_TOOLS_X86
+#endif
+
+#ifndef MATRIX_TRANSPOSE_BS
+    #define MATRIX_TRANSPOSE_BS 64
+#endif
 
 enum {
         NS_PER_SECOND = 1000000000,
@@ -10,40 +24,272 @@ enum {
         MATRIX_ELEM_MAX = 100
     };
 
-long* create_matrix(size_t dim)
+void* create_typed_matrix(size_t dim, size_t elem_size)
 {
-    const int prot_flags = PROT_READ|PROT_WRITE;
-    const int map_flags = MAP_PRIVATE|MAP_ANON; // MAP_POPULATE
-    void* ptr = mmap(NULL, sizeof(long)*dim*dim, prot_flags, map_flags, -1, 0);
-    if(ptr == MAP_FAILED) {
-        perror("mmap");
-        return NULL;
-    }
+    return create_buffer(elem_size*dim*dim);
+}
+
+void delete_typed_matrix(void* matrix, size_t dim, size_t elem_size)
+{
+    delete_buffer(matrix, elem_size*dim*dim);
+}
+
+// Rectangular rows x cols matrices, the square functions below are the rows == cols case
+long* create_rect_matrix(size_t rows, size_t cols)
+{
+    return (long*)create_buffer(sizeof(long)*rows*cols);
+}
+
+void delete_rect_matrix(long* matrix, size_t rows, size_t cols)
+{
+    delete_buffer(matrix, sizeof(long)*rows*cols);
+}
+
+void init_rect_matrix(long* matrix, size_t rows, size_t cols, unsigned int seed)
+{
+    fill_random(matrix, rows*cols, seed, MATRIX_ELEM_MAX);
+}
 
-    return (long*)ptr;
+long* create_matrix(size_t dim)
+{
+    return create_rect_matrix(dim, dim);
 }
 
 void delete_matrix(long* matrix, size_t dim)
 {
-    munmap(matrix, sizeof(long)*dim*dim);
+    delete_rect_matrix(matrix, dim, dim);
 }
 
 void init_matrix(long* matrix, size_t dim, unsigned int seed)
 {
-    srand(seed);
+    init_rect_matrix(matrix, dim, dim, seed);
+}
+
+void _init_matrix_elements(void* data, size_t len, unsigned int seed)
+{
+    fill_random((long*)data, len, seed, MATRIX_ELEM_MAX);
+}
+
+// Same contents as create_rect_matrix() + init_rect_matrix(), but cached in a dataset file
+long* open_rect_matrix(const char* path, size_t rows, size_t cols, unsigned int seed, int writable)
+{
+    return (long*)open_dataset(path, rows, cols, DATASET_I64, sizeof(long), seed, writable, _init_matrix_elements);
+}
+
+void close_rect_matrix(long* matrix, size_t rows, size_t cols)
+{
+    unmap_dataset(matrix, sizeof(long)*rows*cols);
+}
+
+int save_rect_matrix(const char* path, long* matrix, size_t rows, size_t cols)
+{
+    return save_dataset(path, matrix, rows, cols, DATASET_I64, sizeof(long), 0);
+}
+
+long* open_matrix(const char* path, size_t dim, unsigned int seed, int writable)
+{
+    return open_rect_matrix(path, dim, dim, seed, writable);
+}
+
+void close_matrix(long* matrix, size_t dim)
+{
+    close_rect_matrix(matrix, dim, dim);
+}
+
+int save_matrix(const char* path, long* matrix, size_t dim)
+{
+    return save_rect_matrix(path, matrix, dim, dim);
+}
 
-    for (size_t i = 0; i < dim*dim; ++i) {
-        matrix[i] = rand() % MATRIX_ELEM_MAX;
+// dst[j][i] = src[i][j] for a rows x cols block
+void _transpose_block(long* src, size_t lds, long* dst, size_t ldd, size_t rows, size_t cols)
+{
+    for (size_t i = 0; i < rows; ++i) {
+        for (size_t j = 0; j < cols; ++j) {
+            dst[j*ldd + i] = src[i*lds + j];
+        }
     }
 }
 
-void transpose_matrix(long* A, long* T, size_t dim) {
-    for (size_t i = 0; i < dim; ++i) {
-        for (size_t j = 0; j < dim; ++j) {
-            T[j*dim + i] = A[i*dim + j];
+#ifdef MATRIX_TOOLS_X86
+// With stream set, rows of dst must be 32/64-byte aligned and are written with
+// non-temporal stores: the destination is not read back soon and this saves the
+// read-for-ownership of every line, which otherwise costs half of the bandwidth
+__attribute__((target("avx2")))
+void _transpose_4x4_avx2(long* src, size_t lds, long* dst, size_t ldd, int stream)
+{
+    __m256i r0 = _mm256_loadu_si256((__m256i*)&src[0*lds]);
+    __m256i r1 = _mm256_loadu_si256((__m256i*)&src[1*lds]);
+    __m256i r2 = _mm256_loadu_si256((__m256i*)&src[2*lds]);
+    __m256i r3 = _mm256_loadu_si256((__m256i*)&src[3*lds]);
+
+    __m256i t0 = _mm256_unpacklo_epi64(r0, r1);
+    __m256i t1 = _mm256_unpackhi_epi64(r0, r1);
+    __m256i t2 = _mm256_unpacklo_epi64(r2, r3);
+    __m256i t3 = _mm256_unpackhi_epi64(r2, r3);
+
+    __m256i c[4] = {
+        _mm256_permute2x128_si256(t0, t2, 0x20),
+        _mm256_permute2x128_si256(t1, t3, 0x20),
+        _mm256_permute2x128_si256(t0, t2, 0x31),
+        _mm256_permute2x128_si256(t1, t3, 0x31)
+    };
+
+    for (int i = 0; i < 4; ++i) {
+        if (stream) {
+            _mm256_stream_si256((__m256i*)&dst[i*ldd], c[i]);
+        } else {
+            _mm256_storeu_si256((__m256i*)&dst[i*ldd], c[i]);
+        }
+    }
+}
+
+__attribute__((target("avx512f")))
+void _transpose_8x8_avx512(long* src, size_t lds, long* dst, size_t ldd, int stream)
+{
+    __m512i r[8], t[8], u[8];
+    for (int i = 0; i < 8; ++i) {
+        r[i] = _mm512_loadu_si512(&src[i*lds]);
+    }
+
+    // Pairs of rows interleaved, then 128-bit lanes gathered in two steps
+    for (int i = 0; i < 8; i += 2) {
+        t[i] = _mm512_unpacklo_epi64(r[i], r[i + 1]);
+        t[i + 1] = _mm512_unpackhi_epi64(r[i], r[i + 1]);
+    }
+    for (int i = 0; i < 8; i += 4) {
+        u[i] = _mm512_shuffle_i64x2(t[i], t[i + 2], 0x88);
+        u[i + 1] = _mm512_shuffle_i64x2(t[i], t[i + 2], 0xDD);
+        u[i + 2] = _mm512_shuffle_i64x2(t[i + 1], t[i + 3], 0x88);
+        u[i + 3] = _mm512_shuffle_i64x2(t[i + 1], t[i + 3], 0xDD);
+    }
+
+    __m512i c[8] = {
+        _mm512_shuffle_i64x2(u[0], u[4], 0x88),
+        _mm512_shuffle_i64x2(u[2], u[6], 0x88),
+        _mm512_shuffle_i64x2(u[1], u[5], 0x88),
+        _mm512_shuffle_i64x2(u[3], u[7], 0x88),
+        _mm512_shuffle_i64x2(u[0], u[4], 0xDD),
+        _mm512_shuffle_i64x2(u[2], u[6], 0xDD),
+        _mm512_shuffle_i64x2(u[1], u[5], 0xDD),
+        _mm512_shuffle_i64x2(u[3], u[7], 0xDD)
+    };
+
+    for (int i = 0; i < 8; ++i) {
+        if (stream) {
+            _mm512_stream_si512((__m512i*)&dst[i*ldd], c[i]);
+        } else {
+            _mm512_storeu_si512(&dst[i*ldd], c[i]);
         }
     }
 }
+#endif
+
+// In-register transpose of a bs x bs block, picked once per transpose call
+typedef struct {
+    size_t bs;
+    void (*micro)(long* src, size_t lds, long* dst, size_t ldd, int stream);
+} transpose_kernel_t;
+
+transpose_kernel_t _select_transpose_kernel()
+{
+    transpose_kernel_t kernel = {0, NULL};
+#ifdef MATRIX_TOOLS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        kernel.bs = 8;
+        kernel.micro = _transpose_8x8_avx512;
+    } else if (__builtin_cpu_supports("avx2")) {
+        kernel.bs = 4;
+        kernel.micro = _transpose_4x4_avx2;
+    }
+#endif
+
+    return kernel;
+}
+
+// Transposes one rows x cols tile with the micro-kernel, leftovers go scalar
+void _transpose_tile(transpose_kernel_t kernel, long* src, size_t lds, long* dst, size_t ldd, size_t rows, size_t cols, int stream)
+{
+    if (!kernel.micro) {
+        _transpose_block(src, lds, dst, ldd, rows, cols);
+        return;
+    }
+
+    size_t bs = kernel.bs;
+    size_t rows_main = rows - rows % bs;
+    size_t cols_main = cols - cols % bs;
+
+    for (size_t i = 0; i < rows_main; i += bs) {
+        for (size_t j = 0; j < cols_main; j += bs) {
+            kernel.micro(&src[i*lds + j], lds, &dst[j*ldd + i], ldd, stream);
+        }
+    }
+
+    _transpose_block(&src[cols_main], lds, &dst[cols_main*ldd], ldd, rows, cols - cols_main);
+    _transpose_block(&src[rows_main*lds], lds, &dst[rows_main], ldd, rows - rows_main, cols_main);
+}
+
+// T = A^T, tiles of MATRIX_TRANSPOSE_BS fit in L1 and are spread over threads
+void transpose_matrix(long* A, long* T, size_t dim)
+{
+    const size_t bs = MATRIX_TRANSPOSE_BS;
+    transpose_kernel_t kernel = _select_transpose_kernel();
+    const size_t align = kernel.bs * sizeof(long);
+    const int stream = kernel.micro && dim % kernel.bs == 0 && (size_t)T % align == 0;
+
+    // Streaming stores are weakly ordered, every thread fences its own before the closing barrier
+    #pragma omp parallel
+    {
+        #pragma omp for collapse(2) schedule(static) nowait
+        for (size_t i = 0; i < dim; i += bs) {
+            for (size_t j = 0; j < dim; j += bs) {
+                size_t rows = (dim - i < bs) ? dim - i : bs;
+                size_t cols = (dim - j < bs) ? dim - j : bs;
+
+                _transpose_tile(kernel, &A[i*dim + j], dim, &T[j*dim + i], dim, rows, cols, stream);
+            }
+        }
+
+#ifdef MATRIX_TOOLS_X86
+        _mm_sfence();
+#endif
+    }
+}
+
+// A = A^T without a second matrix: tile pairs (i, j) and (j, i) are swapped
+// through a per-thread buffer, diagonal tiles are transposed through it in place
+void transpose_matrix_inplace(long* A, size_t dim)
+{
+    const size_t bs = MATRIX_TRANSPOSE_BS;
+    transpose_kernel_t kernel = _select_transpose_kernel();
+
+    #pragma omp parallel
+    {
+        long* tile = (long*)malloc(sizeof(long) * bs * bs);
+
+        #pragma omp for schedule(dynamic)
+        for (size_t i = 0; i < dim; i += bs) {
+            for (size_t j = i; j < dim; j += bs) {
+                size_t rows = (dim - i < bs) ? dim - i : bs;
+                size_t cols = (dim - j < bs) ? dim - j : bs;
+                long* X = &A[i*dim + j];
+                long* Y = &A[j*dim + i];
+
+                for (size_t r = 0; r < rows; ++r) {
+                    memcpy(&tile[r*bs], &X[r*dim], sizeof(long) * cols);
+                }
+
+                if (i != j) {
+                    _transpose_tile(kernel, Y, dim, X, dim, cols, rows, 0);
+                }
+                _transpose_tile(kernel, tile, bs, Y, dim, rows, cols, 0);
+            }
+        }
+
+        free(tile);
+    }
+}
 
 void print_matrix(long* matrix, size_t dim)
 {
@@ -55,12 +301,91 @@ void print_matrix(long* matrix, size_t dim)
     }
 }
 
-unsigned int hash_matrix(long* matrix, size_t dim)
+unsigned int hash_rect_matrix(long* matrix, size_t rows, size_t cols)
 {
     unsigned int hash = 0;
-    for (size_t i = 0; i < dim*dim; ++i) {
-        hash += (i % dim) * ((long)matrix[i] ^ MAGIC_KEY);
+    for (size_t i = 0; i < rows*cols; ++i) {
+        hash += (i % cols) * ((long)matrix[i] ^ MAGIC_KEY);
     }
 
     return hash;
 }
+
+unsigned int hash_matrix(long* matrix, size_t dim)
+{
+    return hash_rect_matrix(matrix, dim, dim);
+}
+
+// y = M*x for a rows x cols M in arithmetic modulo 2^64
+void _mul_matrix_vector(long* M, uint64_t* x, uint64_t* y, size_t rows, size_t cols)
+{
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < rows; ++i) {
+        uint64_t sum = 0;
+        for (size_t k = 0; k < cols; ++k) {
+            sum += (uint64_t)M[i*cols + k] * x[k];
+        }
+        y[i] = sum;
+    }
+}
+
+// Freivalds' check of C == alpha*A*B + beta*C0 for m x k A, k x n B and m x n C, C0
+// (C0 may be NULL if beta is 0) in O(rounds * (mk + kn + mn)): compares both sides
+// multiplied by random vectors r. A wrong C survives a round with probability at most
+// 1/2 (and typically about 2^-64), so a few rounds are enough. Returns 1 if C passed.
+int verify_gemm(long* A, long* B, long* C, long* C0, size_t m, size_t n, size_t k, long alpha, long beta, int rounds, unsigned int seed)
+{
+    uint64_t* r = (uint64_t*)malloc(sizeof(uint64_t) * n);
+    uint64_t* Br = (uint64_t*)malloc(sizeof(uint64_t) * k);
+    uint64_t* ABr = (uint64_t*)malloc(sizeof(uint64_t) * m);
+    uint64_t* Cr = (uint64_t*)malloc(sizeof(uint64_t) * m);
+    uint64_t* C0r = (uint64_t*)calloc(m, sizeof(uint64_t));
+    int passed = 1;
+
+    for (int round = 0; round < rounds && passed; ++round) {
+        #pragma omp parallel for simd schedule(static)
+        for (size_t i = 0; i < n; ++i) {
+            r[i] = random_at(seed + round, i);
+        }
+
+        _mul_matrix_vector(B, r, Br, k, n);
+        _mul_matrix_vector(A, Br, ABr, m, k);
+        _mul_matrix_vector(C, r, Cr, m, n);
+        if (beta) {
+            _mul_matrix_vector(C0, r, C0r, m, n);
+        }
+
+        for (size_t i = 0; i < m && passed; ++i) {
+            passed = Cr[i] == (uint64_t)alpha*ABr[i] + (uint64_t)beta*C0r[i];
+        }
+    }
+
+    free(r);
+    free(Br);
+    free(ABr);
+    free(Cr);
+    free(C0r);
+
+    return passed;
+}
+
+int verify_matrix(long* A, long* B, long* C, size_t dim, int rounds, unsigned int seed)
+{
+    return verify_gemm(A, B, C, NULL, dim, dim, dim, 1, 0, rounds, seed);
+}
+
+// Resets peak resident set size (VmHWM) of the process, requires Linux 4.0+
+void reset_peak_memory()
+{
+    FILE* file = fopen("/proc/self/clear_refs", "w");
+    if (file) {
+        fputs("5", file);
+        fclose(file);
+    }
+}
+
+// Reads a memory field such as "VmRSS:" or "VmHWM:" from /proc/self/status, in kB
+size_t get_memory_kb(const char* field)
+{
+    return _read_proc_kb("/proc/self/status", field);
+}
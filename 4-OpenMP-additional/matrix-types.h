@@ -0,0 +1,131 @@
+#pragma once
+
+#include "matrix-tools.h"
+#include <stdint.h>
+#include <omp.h>
+
+/*
+    Element-type-generic matrices. Each type stores A and B in a narrow
+    element type and accumulates C in a wider one:
+
+        type  storage   accumulator  exact while
+        i16   int16_t   int32_t      dim * max|a| * max|b| < 2^31
+        i32   int32_t   int64_t      dim * max|a| * max|b| < 2^63
+        f32   float     float        dim * max|a| * max|b| < 2^24
+        f64   double    double       dim * max|a| * max|b| < 2^53
+
+    Storage must hold the inputs (MATRIX_ELEM_MAX fits all of them).
+    Past the bound integer types wrap around and floating-point types
+    round, so hash_matrix() stops matching the long kernels. With
+    MATRIX_ELEM_MAX = 100 that happens above dim 214748 for i16 and
+    above dim 1677 for f32. Floating-point kernels use FMA where the
+    CPU supports it.
+
+    Only the storage, one tiled square multiply and the hash are generic.
+    Inputs are still created, loaded from datasets and kept as long
+    matrices and converted with convert(); C is widened back to long with
+    widen() for verify_gemm() and saving. Rectangular GEMM and the other
+    kernels of matrix.c stay long-only.
+*/
+
+// Typed kernels are tiled like simd_mul_matrix(): a strip of C row stays in L1
+// while a MATRIX_TYPED_KC x MATRIX_TYPED_NB block of B is reused across rows
+#ifndef MATRIX_TYPED_KC
+    #define MATRIX_TYPED_KC 256
+#endif
+#ifndef MATRIX_TYPED_NB
+    #define MATRIX_TYPED_NB 512
+#endif
+
+typedef struct {
+    const char* name;
+    size_t elem_size;
+    size_t acc_size;
+    int is_float;
+    void (*convert)(long* src, void* dst, size_t dim);
+    void (*mul)(void* A, void* B, void* C, size_t dim);
+    unsigned int (*hash)(void* C, size_t dim);
+    void (*widen)(void* src, long* dst, size_t dim);
+} matrix_type_t;
+
+// Kernels below honour the same switch as the long kernels in matrix.c
+extern int enable_omp_parallel;
+
+#define DEFINE_MATRIX_TYPE(SFX, T, ACC_T)                                                    \
+    void convert_matrix_##SFX(long* src, void* dst, size_t dim)                              \
+    {                                                                                        \
+        T* D = (T*)dst;                                                                      \
+        _Pragma("omp parallel for if (enable_omp_parallel)")                                 \
+        for (size_t i = 0; i < dim*dim; ++i) {                                               \
+            D[i] = (T)src[i];                                                                \
+        }                                                                                    \
+    }                                                                                        \
+                                                                                             \
+    __attribute__((target_clones("avx512f", "arch=haswell", "default")))                     \
+    void _typed_mul_strip_##SFX(T* A, T* B, ACC_T* C, size_t dim, size_t j0, size_t j1)      \
+    {                                                                                        \
+        for (size_t kc = 0; kc < dim; kc += MATRIX_TYPED_KC) {                               \
+            size_t kend = (dim - kc < MATRIX_TYPED_KC) ? dim : kc + MATRIX_TYPED_KC;         \
+            for (size_t i = 0; i < dim; ++i) {                                               \
+                ACC_T* rC = &C[i*dim];                                                       \
+                for (size_t k = kc; k < kend; ++k) {                                         \
+                    ACC_T a = A[i*dim + k];                                                  \
+                    T* rB = &B[k*dim];                                                       \
+                    for (size_t j = j0; j < j1; ++j) {                                       \
+                        rC[j] += a * (ACC_T)rB[j];                                           \
+                    }                                                                        \
+                }                                                                            \
+            }                                                                                \
+        }                                                                                    \
+    }                                                                                        \
+                                                                                             \
+    void typed_mul_matrix_##SFX(void* A, void* B, void* C, size_t dim)                       \
+    {                                                                                        \
+        _Pragma("omp parallel for schedule(runtime) if (enable_omp_parallel)")               \
+        for (size_t j = 0; j < dim; j += MATRIX_TYPED_NB) {                                  \
+            size_t jend = (dim - j < MATRIX_TYPED_NB) ? dim : j + MATRIX_TYPED_NB;           \
+            _typed_mul_strip_##SFX((T*)A, (T*)B, (ACC_T*)C, dim, j, jend);                   \
+        }                                                                                    \
+    }                                                                                        \
+                                                                                             \
+    void widen_matrix_##SFX(void* src, long* dst, size_t dim)                                \
+    {                                                                                        \
+        ACC_T* S = (ACC_T*)src;                                                              \
+        _Pragma("omp parallel for if (enable_omp_parallel)")                                 \
+        for (size_t i = 0; i < dim*dim; ++i) {                                               \
+            dst[i] = (long)S[i];                                                             \
+        }                                                                                    \
+    }                                                                                        \
+                                                                                             \
+    unsigned int hash_matrix_##SFX(void* matrix, size_t dim)                                 \
+    {                                                                                        \
+        ACC_T* M = (ACC_T*)matrix;                                                           \
+        unsigned int hash = 0;                                                               \
+        for (size_t i = 0; i < dim*dim; ++i) {                                               \
+            hash += (i % dim) * ((long)M[i] ^ MAGIC_KEY);                                    \
+        }                                                                                    \
+                                                                                             \
+        return hash;                                                                         \
+    }
+
+DEFINE_MATRIX_TYPE(i16, int16_t, int32_t)
+DEFINE_MATRIX_TYPE(i32, int32_t, int64_t)
+DEFINE_MATRIX_TYPE(f32, float, float)
+DEFINE_MATRIX_TYPE(f64, double, double)
+
+#define MATRIX_TYPE_ENTRY(SFX, T, ACC_T, IS_FLOAT) \
+    {#SFX, sizeof(T), sizeof(ACC_T), IS_FLOAT, convert_matrix_##SFX, typed_mul_matrix_##SFX, hash_matrix_##SFX, widen_matrix_##SFX}
+
+const matrix_type_t matrix_types[] = {
+    MATRIX_TYPE_ENTRY(i16, int16_t, int32_t, 0),
+    MATRIX_TYPE_ENTRY(i32, int32_t, int64_t, 0),
+    MATRIX_TYPE_ENTRY(f32, float, float, 1),
+    MATRIX_TYPE_ENTRY(f64, double, double, 1),
+};
+
+enum {
+        MATRIX_I16,
+        MATRIX_I32,
+        MATRIX_F32,
+        MATRIX_F64
+    };
@@ -1,102 +1,49 @@
 #include "matrix-tools.h"
+#include "matrix-types.h"
+#include "matrix-kernels.h"
+#include "matrix-batch.h"
+#include "tune-tools.h"
+#include "perf-tools.h"
+#include "bench-tools.h"
 #include <immintrin.h>
+#include <getopt.h>
+#include <limits.h>
+#include <string.h>
 #include <omp.h>
 
 #ifndef MATRIX_DIM
     #define MATRIX_DIM 8192
 #endif
-#ifndef MATRIX_MUL_BS
-    #define MATRIX_MUL_BS 512
-#endif
 #ifndef MATRIX_FASTMUL_THRESHHOLD
     #define MATRIX_FASTMUL_THRESHHOLD 128
 #endif
-
-#ifdef PARALLEL
-    const int enable_omp_parallel = 1;
-#else
-    const int enable_omp_parallel = 0;
+// 0 means measure the Winograd crossover at startup
+#ifndef MATRIX_WINOGRAD_THRESHHOLD
+    #define MATRIX_WINOGRAD_THRESHHOLD 0
+#endif
+#ifndef MATRIX_WINOGRAD_CALIBRATION_MIN
+    #define MATRIX_WINOGRAD_CALIBRATION_MIN 64
+#endif
+#ifndef MATRIX_WINOGRAD_CALIBRATION_MAX
+    #define MATRIX_WINOGRAD_CALIBRATION_MAX 1024
+#endif
+#ifndef MATRIX_TUNE_DIM
+    #define MATRIX_TUNE_DIM 1024
+#endif
+#ifndef MATRIX_TUNE_REPS
+    #define MATRIX_TUNE_REPS 2
 #endif
 
-void mul_matrix(long* A, long* B, long* C, size_t dim)
-{
-    #pragma omp parallel for if (enable_omp_parallel)
-        for (size_t i = 0; i < dim; ++i) {
-            for (size_t j = 0; j < dim; ++j) {
-                for (size_t k = 0; k < dim; ++k) {
-                    C[i*dim + j] += A[i*dim + k] * B[k*dim + j];
-                }
-            }
-        }
-}
-
-void transposed_mul_matrix(long* A, long* B, long* C, size_t dim)
-{
-    #pragma omp parallel for if (enable_omp_parallel)
-        for (size_t i = 0; i < dim; ++i) {
-            for (size_t k = 0; k < dim; ++k) {
-                for (size_t j = 0; j < dim; ++j) {
-                    C[i*dim + j] += A[i*dim + k] * B[k*dim + j];
-                }
-            }
-        }
-}
-
-void block_mul_matrix(long* A, long* B, long* C, size_t dim)
-{
-    size_t bs = MATRIX_MUL_BS;
-
-    #pragma omp parallel for if (enable_omp_parallel)
-        for (size_t i = 0; i < dim; i += bs) {
-            for (size_t j = 0; j < dim; j += bs) {
-                for (size_t k = 0; k < dim; k += bs) {
-
-                    long* rC = &C[i*dim + j];
-                    long* rA = &A[i*dim + k];
-                    for (size_t i2 = 0; i2 < bs; ++i2) {
-
-                        long* rB = &B[k*dim + j];
-                        for (size_t k2 = 0; k2 < bs; ++k2) {
-                            for (size_t j2 = 0; j2 < bs; ++j2) {
-                                rC[j2] += rA[k2] * rB[j2];
-                            }
-
-                            rB += dim;
-                        }
-
-                        rC += dim;
-                        rA += dim;
-                    }
-                }
-            }
-        }
-}
-
-#ifdef AVX
-void simd_mul_matrix(long* A, long* BT, long* C, size_t dim)
-{
-    #pragma omp parallel for if (enable_omp_parallel)
-        for (size_t i = 0; i < dim; ++i) {
-            for (size_t j = 0; j < dim; ++j) {
-
-                __m256i c_vec = _mm256_setzero_si256();
-                for (size_t k = 0; k < dim; k += 4) {
-                    __m256i a_vec = _mm256_loadu_si256((__m256i*)&A[i*dim + k]);
-                    __m256i b_vec = _mm256_loadu_si256((__m256i*)&BT[j*dim + k]);
-
-                    __m256i mul_result = _mm256_mul_epi32(a_vec, b_vec);
-
-                    c_vec = _mm256_add_epi64(c_vec, mul_result);
-                }
-
-                long temp[4];
-                _mm256_storeu_si256((__m256i*)temp, c_vec);
-                C[i*dim + j] += temp[0] + temp[1] + temp[2] + temp[3];
-            }
-        }
-}
+// Number of top Strassen levels whose 7 products run as OpenMP tasks.
+// Each task level multiplies the arena size by roughly 7/4.
+#ifndef MATRIX_STRASSEN_TASK_DEPTH
+    #define MATRIX_STRASSEN_TASK_DEPTH 1
 #endif
 
+// Compile-time defaults, can be overridden by the tune cache and then from the command line
+size_t matrix_fastmul_threshhold = MATRIX_FASTMUL_THRESHHOLD;
+size_t matrix_winograd_threshhold = MATRIX_WINOGRAD_THRESHHOLD;
+
 #ifdef AVX
 inline void __avx_add_matrix(long* A, long* B, long* C, size_t dim)
 {
@@ -169,7 +116,7 @@ void _sub_matrix(long* A, long* B, long* C, size_t dim)
 
 void _strassen(long* A, long* B, long* C, size_t dim)
 {
-    if (dim <= MATRIX_FASTMUL_THRESHHOLD) {
+    if (dim <= matrix_fastmul_threshhold) {
         transposed_mul_matrix(A, B, C, dim);
 
         return;
@@ -332,51 +279,1216 @@ void fast_mul_matrix(long* A, long* B, long* C, size_t dim)
     _strassen(A, B, C, dim);
 }
 
-int main()
+// C += A*B on n x n views with leading dimensions lda, ldb, ldc
+void _strided_mul_matrix(long* A, size_t lda, long* B, size_t ldb, long* C, size_t ldc, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t k = 0; k < n; ++k) {
+            long a = A[i*lda + k];
+            for (size_t j = 0; j < n; ++j) {
+                C[i*ldc + j] += a * B[k*ldb + j];
+            }
+        }
+    }
+}
+
+// Adds the contribution of the last row/column of odd-sized A and B,
+// given that C[0:n-1, 0:n-1] already holds A[0:n-1, 0:n-1]*B[0:n-1, 0:n-1]
+void _strassen_peel_fixup(long* A, size_t lda, long* B, size_t ldb, long* C, size_t ldc, size_t n)
+{
+    size_t m = n - 1;
+
+    for (size_t i = 0; i < m; ++i) {
+        long a = A[i*lda + m];
+        for (size_t j = 0; j < m; ++j) {
+            C[i*ldc + j] += a * B[m*ldb + j];
+        }
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        long sum = 0;
+        for (size_t k = 0; k < n; ++k) {
+            sum += A[i*lda + k] * B[k*ldb + m];
+        }
+        C[i*ldc + m] += sum;
+    }
+
+    for (size_t k = 0; k < n; ++k) {
+        long a = A[m*lda + k];
+        for (size_t j = 0; j < m; ++j) {
+            C[m*ldc + j] += a * B[k*ldb + j];
+        }
+    }
+}
+
+// Quadrant q of a 2h x 2h view: 0 = 11, 1 = 12, 2 = 21, 3 = 22
+long* _quadrant(long* M, size_t ld, size_t h, int q)
+{
+    return M + (q >> 1)*h*ld + (q & 1)*h;
+}
+
+// Operand of a Strassen product is X[q0] + sign*X[q1], or just X[q0] if q1 < 0.
+// c[] holds the coefficient the product is added with to each quadrant of C.
+typedef struct {
+    int a[2], a_sign;
+    int b[2], b_sign;
+    int c[4];
+} strassen_product_t;
+
+const strassen_product_t strassen_products[7] = {
+    {{0, 3}, 1, {0, 3}, 1, {1, 0, 0, 1}},    // M1 = (A11 + A22)(B11 + B22)
+    {{2, 3}, 1, {0, -1}, 0, {0, 0, 1, -1}},  // M2 = (A21 + A22)B11
+    {{0, -1}, 0, {1, 3}, -1, {0, 1, 0, 1}},  // M3 = A11(B12 - B22)
+    {{3, -1}, 0, {2, 0}, -1, {1, 0, 1, 0}},  // M4 = A22(B21 - B11)
+    {{0, 1}, 1, {3, -1}, 0, {-1, 1, 0, 0}},  // M5 = (A11 + A12)B22
+    {{2, 0}, -1, {0, 1}, 1, {0, 0, 0, 1}},   // M6 = (A21 - A11)(B11 + B12)
+    {{1, 3}, -1, {2, 3}, 1, {1, 0, 0, 0}},   // M7 = (A12 - A22)(B21 + B22)
+};
+
+// Returns a view of X[q0] + sign*X[q1], materialized into T (ld = h) if needed
+long* _strassen_operand(long* X, size_t ld, size_t h, const int q[2], int sign, long* T, size_t* ld_out)
+{
+    long* X0 = _quadrant(X, ld, h, q[0]);
+    if (q[1] < 0) {
+        *ld_out = ld;
+        return X0;
+    }
+
+    long* X1 = _quadrant(X, ld, h, q[1]);
+    for (size_t i = 0; i < h; ++i) {
+        for (size_t j = 0; j < h; ++j) {
+            T[i*h + j] = X0[i*ld + j] + sign * X1[i*ld + j];
+        }
+    }
+
+    *ld_out = h;
+    return T;
+}
+
+// Workspace needed by _arena_strassen() for a dim x dim product, in elements
+size_t _arena_strassen_size(size_t dim, int task_depth)
+{
+    if (dim <= matrix_fastmul_threshhold) {
+        return 0;
+    }
+    if (dim % 2) {
+        return _arena_strassen_size(dim - 1, task_depth);
+    }
+
+    size_t h = dim / 2;
+    size_t slot = 3*h*h + _arena_strassen_size(h, task_depth > 0 ? task_depth - 1 : 0);
+
+    return task_depth > 0 ? 7*slot : slot;
+}
+
+void _arena_strassen(long* A, size_t lda, long* B, size_t ldb, long* C, size_t ldc, size_t dim, long* ws, int task_depth);
+
+// Computes product p into the M buffer of its workspace slot: [T1 | T2 | M | deeper levels]
+void _arena_strassen_product(long* A, size_t lda, long* B, size_t ldb, size_t h, int p, long* slot, int task_depth)
+{
+    const strassen_product_t* prod = &strassen_products[p];
+    long* M = slot + 2*h*h;
+    size_t ld_a = 0, ld_b = 0;
+
+    long* opA = _strassen_operand(A, lda, h, prod->a, prod->a_sign, slot, &ld_a);
+    long* opB = _strassen_operand(B, ldb, h, prod->b, prod->b_sign, slot + h*h, &ld_b);
+
+    memset(M, 0, sizeof(long)*h*h);
+    _arena_strassen(opA, ld_a, opB, ld_b, M, h, h, slot + 3*h*h, task_depth);
+}
+
+void _arena_strassen_scatter(long* C, size_t ldc, size_t h, int p, long* M)
+{
+    for (int q = 0; q < 4; ++q) {
+        long coef = strassen_products[p].c[q];
+        if (!coef) {
+            continue;
+        }
+
+        long* Cq = _quadrant(C, ldc, h, q);
+        for (size_t i = 0; i < h; ++i) {
+            for (size_t j = 0; j < h; ++j) {
+                Cq[i*ldc + j] += coef * M[i*h + j];
+            }
+        }
+    }
+}
+
+// C += A*B using a preallocated workspace ws of _arena_strassen_size(dim, task_depth) elements.
+// Quadrants are strided views into A, B and C; only operand sums and products are stored.
+// Odd sizes are handled by dynamic peeling of the last row and column.
+void _arena_strassen(long* A, size_t lda, long* B, size_t ldb, long* C, size_t ldc, size_t dim, long* ws, int task_depth)
+{
+    if (dim <= matrix_fastmul_threshhold) {
+        _strided_mul_matrix(A, lda, B, ldb, C, ldc, dim);
+
+        return;
+    }
+
+    if (dim % 2) {
+        _arena_strassen(A, lda, B, ldb, C, ldc, dim - 1, ws, task_depth);
+        _strassen_peel_fixup(A, lda, B, ldb, C, ldc, dim);
+
+        return;
+    }
+
+    size_t h = dim / 2;
+    size_t slot = 3*h*h + _arena_strassen_size(h, task_depth > 0 ? task_depth - 1 : 0);
+
+    if (task_depth > 0) {
+        for (int p = 0; p < 7; ++p) {
+            #pragma omp task firstprivate(p)
+                _arena_strassen_product(A, lda, B, ldb, h, p, ws + p*slot, task_depth - 1);
+        }
+
+        #pragma omp taskwait
+        for (int p = 0; p < 7; ++p) {
+            _arena_strassen_scatter(C, ldc, h, p, ws + p*slot + 2*h*h);
+        }
+    } else {
+        for (int p = 0; p < 7; ++p) {
+            _arena_strassen_product(A, lda, B, ldb, h, p, ws, 0);
+            _arena_strassen_scatter(C, ldc, h, p, ws + 2*h*h);
+        }
+    }
+}
+
+void arena_fast_mul_matrix(long* A, long* B, long* C, size_t dim)
+{
+    int task_depth = enable_omp_parallel ? MATRIX_STRASSEN_TASK_DEPTH : 0;
+    long* ws = (long*)malloc(sizeof(long) * (_arena_strassen_size(dim, task_depth) + 1));
+
+    #pragma omp parallel if (task_depth > 0)
+    {
+        #pragma omp single
+            _arena_strassen(A, dim, B, dim, C, dim, dim, ws, task_depth);
+    }
+
+    free(ws);
+}
+
+// Z = X + sign*Y on h x h views
+void _winograd_sum(long* X, size_t ldx, long* Y, size_t ldy, long sign, long* Z, size_t ldz, size_t h)
+{
+    for (size_t i = 0; i < h; ++i) {
+        for (size_t j = 0; j < h; ++j) {
+            Z[i*ldz + j] = X[i*ldx + j] + sign * Y[i*ldy + j];
+        }
+    }
+}
+
+// C += M on h x h views
+void _winograd_acc(long* M, size_t ldm, long* C, size_t ldc, size_t h)
 {
-    printf("Matrix size: %d x %d\n", MATRIX_DIM, MATRIX_DIM);
+    for (size_t i = 0; i < h; ++i) {
+        for (size_t j = 0; j < h; ++j) {
+            C[i*ldc + j] += M[i*ldm + j];
+        }
+    }
+}
+
+// Workspace needed by _winograd() for a dim x dim product, in elements.
+// Serial levels need S, T and U; task levels keep all 8 operand sums and 7 products.
+size_t _winograd_size(size_t dim, int task_depth)
+{
+    if (dim <= matrix_winograd_threshhold) {
+        return 0;
+    }
+    if (dim % 2) {
+        return _winograd_size(dim - 1, task_depth);
+    }
+
+    size_t h = dim / 2;
+    if (task_depth > 0) {
+        return 8*h*h + 7*(h*h + _winograd_size(h, task_depth - 1));
+    }
+
+    return 3*h*h + _winograd_size(h, 0);
+}
+
+/*
+    Strassen-Winograd variant: 7 products and 15 additions per level
+
+        S1 = A21 + A22   T1 = B12 - B11   P1 = A11*B11   P5 = S1*T1
+        S2 = S1 - A11    T2 = B22 - T1    P2 = A12*B21   P6 = S2*T2
+        S3 = A11 - A21   T3 = B22 - B12   P3 = S4*B22    P7 = S3*T3
+        S4 = A12 - S2    T4 = T2 - B21    P4 = A22*T4
+
+        U2 = P1 + P6     C11 = P1 + P2          C21 = U3 - P4
+        U3 = U2 + P7     C12 = U2 + P5 + P3     C22 = U3 + P5
+
+    T4 is stored negated so that every product is accumulated with +=.
+*/
+void _winograd(long* A, size_t lda, long* B, size_t ldb, long* C, size_t ldc, size_t dim, long* ws, int task_depth, gemm_t leaf)
+{
+    if (dim <= matrix_winograd_threshhold) {
+        leaf(dim, dim, dim, 1, A, lda, B, ldb, 1, C, ldc);
+
+        return;
+    }
+
+    if (dim % 2) {
+        _winograd(A, lda, B, ldb, C, ldc, dim - 1, ws, task_depth, leaf);
+        _strassen_peel_fixup(A, lda, B, ldb, C, ldc, dim);
+
+        return;
+    }
+
+    size_t h = dim / 2;
+    size_t hh = h*h;
+    long* A11 = _quadrant(A, lda, h, 0), *A12 = _quadrant(A, lda, h, 1), *A21 = _quadrant(A, lda, h, 2), *A22 = _quadrant(A, lda, h, 3);
+    long* B11 = _quadrant(B, ldb, h, 0), *B12 = _quadrant(B, ldb, h, 1), *B21 = _quadrant(B, ldb, h, 2), *B22 = _quadrant(B, ldb, h, 3);
+    long* C11 = _quadrant(C, ldc, h, 0), *C12 = _quadrant(C, ldc, h, 1), *C21 = _quadrant(C, ldc, h, 2), *C22 = _quadrant(C, ldc, h, 3);
+
+    if (task_depth > 0) {
+        long* S = ws;           // S1..S4
+        long* T = ws + 4*hh;    // T1..T3, -T4
+        long* slots = ws + 8*hh;
+        size_t slot = hh + _winograd_size(h, task_depth - 1);
+
+        _winograd_sum(A21, lda, A22, lda, 1, &S[0], h, h);
+        _winograd_sum(&S[0], h, A11, lda, -1, &S[hh], h, h);
+        _winograd_sum(A11, lda, A21, lda, -1, &S[2*hh], h, h);
+        _winograd_sum(A12, lda, &S[hh], h, -1, &S[3*hh], h, h);
+        _winograd_sum(B12, ldb, B11, ldb, -1, &T[0], h, h);
+        _winograd_sum(B22, ldb, &T[0], h, -1, &T[hh], h, h);
+        _winograd_sum(B22, ldb, B12, ldb, -1, &T[2*hh], h, h);
+        _winograd_sum(B21, ldb, &T[hh], h, -1, &T[3*hh], h, h);
+
+        // Operands of P1..P7 as (X, ldx, Y, ldy)
+        long* X[7] = {A11, A12, &S[3*hh], A22, &S[0], &S[hh], &S[2*hh]};
+        long* Y[7] = {B11, B21, B22, &T[3*hh], &T[0], &T[hh], &T[2*hh]};
+        size_t ldx[7] = {lda, lda, h, lda, h, h, h};
+        size_t ldy[7] = {ldb, ldb, ldb, h, h, h, h};
+
+        for (int p = 0; p < 7; ++p) {
+            #pragma omp task firstprivate(p)
+            {
+                long* P = slots + p*slot;
+                memset(P, 0, sizeof(long)*hh);
+                _winograd(X[p], ldx[p], Y[p], ldy[p], P, h, h, P + hh, task_depth - 1, leaf);
+            }
+        }
+        #pragma omp taskwait
+
+        long* P[7] = {0};
+        for (int p = 0; p < 7; ++p) {
+            P[p] = slots + p*slot;
+        }
+
+        _winograd_acc(P[0], h, C11, ldc, h);
+        _winograd_acc(P[1], h, C11, ldc, h);
+        _winograd_acc(P[5], h, P[0], h, h);  // P1 becomes U2
+        _winograd_acc(P[0], h, C12, ldc, h);
+        _winograd_acc(P[4], h, C12, ldc, h);
+        _winograd_acc(P[2], h, C12, ldc, h);
+        _winograd_acc(P[6], h, P[0], h, h);  // U2 becomes U3
+        _winograd_acc(P[0], h, C21, ldc, h);
+        _winograd_acc(P[3], h, C21, ldc, h);
+        _winograd_acc(P[0], h, C22, ldc, h);
+        _winograd_acc(P[4], h, C22, ldc, h);
+
+        return;
+    }
+
+    // Serial schedule with three temporaries, products accumulate straight into C where possible
+    long* S = ws;
+    long* T = ws + hh;
+    long* U = ws + 2*hh;
+    long* deeper = ws + 3*hh;
+
+    _winograd_sum(A21, lda, A22, lda, 1, S, h, h);      // S1
+    _winograd_sum(B12, ldb, B11, ldb, -1, T, h, h);     // T1
+    memset(U, 0, sizeof(long)*hh);
+    _winograd(S, h, T, h, U, h, h, deeper, 0, leaf);    // U = P5
+    _winograd_acc(U, h, C12, ldc, h);
+    _winograd_acc(U, h, C22, ldc, h);
+
+    _winograd_sum(S, h, A11, lda, -1, S, h, h);         // S2
+    _winograd_sum(B22, ldb, T, h, -1, T, h, h);         // T2
+    memset(U, 0, sizeof(long)*hh);
+    _winograd(A11, lda, B11, ldb, U, h, h, deeper, 0, leaf);  // U = P1
+    _winograd_acc(U, h, C11, ldc, h);
+    _winograd(A12, lda, B21, ldb, C11, ldc, h, deeper, 0, leaf);  // C11 += P2
+    _winograd(S, h, T, h, U, h, h, deeper, 0, leaf);    // U = U2
+
+    _winograd_sum(A12, lda, S, h, -1, S, h, h);         // S4
+    _winograd(S, h, B22, ldb, C12, ldc, h, deeper, 0, leaf);  // C12 += P3
+    _winograd_acc(U, h, C12, ldc, h);
+
+    _winograd_sum(B21, ldb, T, h, -1, T, h, h);         // -T4
+    _winograd(A22, lda, T, h, C21, ldc, h, deeper, 0, leaf);  // C21 -= P4
+
+    _winograd_sum(A11, lda, A21, lda, -1, S, h, h);     // S3
+    _winograd_sum(B22, ldb, B12, ldb, -1, T, h, h);     // T3
+    _winograd(S, h, T, h, U, h, h, deeper, 0, leaf);    // U = U3
+    _winograd_acc(U, h, C21, ldc, h);
+    _winograd_acc(U, h, C22, ldc, h);
+}
+
+void _winograd_mul(long* A, long* B, long* C, size_t dim)
+{
+    int task_depth = enable_omp_parallel ? MATRIX_STRASSEN_TASK_DEPTH : 0;
+    long* ws = (long*)malloc(sizeof(long) * (_winograd_size(dim, task_depth) + 1));
+    gemm_t leaf = _select_simd_kernel();
+
+    #pragma omp parallel if (task_depth > 0)
+    {
+        #pragma omp single
+            _winograd(A, dim, B, dim, C, dim, dim, ws, task_depth, leaf);
+    }
+
+    free(ws);
+}
+
+// Finds the size above which one Winograd level beats the SIMD leaf it bottoms out in,
+// by timing both on doubling sizes up to max_dim. Returns the largest size where the
+// leaf still won.
+size_t calibrate_winograd_threshhold(size_t max_dim)
+{
+    const size_t saved = matrix_winograd_threshhold;
+    const size_t limit = max_dim < MATRIX_WINOGRAD_CALIBRATION_MAX ? max_dim : MATRIX_WINOGRAD_CALIBRATION_MAX;
+    size_t best = limit;
+
+    for (size_t n = 2*MATRIX_WINOGRAD_CALIBRATION_MIN; n <= limit; n *= 2) {
+        long* A = create_matrix(n);
+        long* B = create_matrix(n);
+        long* C = create_matrix(n);
+        if (!A || !B || !C) {
+            exit(EXIT_FAILURE);
+        }
+        init_matrix(A, n, 0xA);
+        init_matrix(B, n, 0xB);
+
+        double t_leaf = 1e30, t_level = 1e30;
+        for (int rep = 0; rep < 2; ++rep) {
+            double start = omp_get_wtime();
+            simd_mul_matrix(A, B, C, n);
+            double t = omp_get_wtime() - start;
+            t_leaf = t < t_leaf ? t : t_leaf;
+
+            matrix_winograd_threshhold = n / 2;
+            start = omp_get_wtime();
+            _winograd_mul(A, B, C, n);
+            t = omp_get_wtime() - start;
+            t_level = t < t_level ? t : t_level;
+            matrix_winograd_threshhold = saved;
+        }
+
+        delete_matrix(A, n);
+        delete_matrix(B, n);
+        delete_matrix(C, n);
+
+        if (t_level < t_leaf) {
+            best = n / 2;
+            break;
+        }
+    }
+
+    return best;
+}
+
+void winograd_mul_matrix(long* A, long* B, long* C, size_t dim)
+{
+    if (!matrix_winograd_threshhold) {
+        matrix_winograd_threshhold = calibrate_winograd_threshhold(dim);
+    }
+
+    _winograd_mul(A, B, C, dim);
+}
+
+// Kernels with a GEMM form also run rectangular shapes and alpha/beta.
+// Kernels with a non-NULL type run on copies of A and B converted to that type.
+typedef struct {
+    const char* name;
+    void (*mul)(long* A, long* B, long* C, size_t dim);
+    const matrix_type_t* type;
+    gemm_t gemm;
+} matrix_kernel_t;
+
+const matrix_kernel_t matrix_kernels[] = {
+    {"naive", mul_matrix, NULL, naive_gemm},
+    {"transpose", transposed_mul_matrix, NULL, transposed_gemm},
+    {"block", block_mul_matrix, NULL, block_gemm},
+    {"packed", packed_mul_matrix, NULL, packed_gemm},
+    {"simd", simd_mul_matrix, NULL, simd_gemm},
+    {"fast", fast_mul_matrix, NULL, NULL},
+    {"fast-arena", arena_fast_mul_matrix, NULL, NULL},
+    {"winograd", winograd_mul_matrix, NULL, NULL},
+    {"tiled-i16", NULL, &matrix_types[MATRIX_I16], NULL},
+    {"tiled-i32", NULL, &matrix_types[MATRIX_I32], NULL},
+    {"tiled-f32", NULL, &matrix_types[MATRIX_F32], NULL},
+    {"tiled-f64", NULL, &matrix_types[MATRIX_F64], NULL},
+};
+
+const size_t num_matrix_kernels = sizeof(matrix_kernels)/sizeof(matrix_kernels[0]);
+
+// Old -DTRANSPOSE/-DBLOCK/... build flags still pick the default kernel
+#ifdef TRANSPOSE
+    #define MATRIX_DEFAULT_KERNEL "transpose"
+#elif BLOCK
+    #define MATRIX_DEFAULT_KERNEL "block"
+#elif PACKED
+    #define MATRIX_DEFAULT_KERNEL "packed"
+#elif SIMD
+    #define MATRIX_DEFAULT_KERNEL "simd"
+#elif FAST
+    #define MATRIX_DEFAULT_KERNEL "winograd"
+#else
+    #define MATRIX_DEFAULT_KERNEL "naive"
+#endif
+
+enum {
+        MAX_SWEEP_LEN = 32,
+        FREIVALDS_ROUNDS = 2
+    };
+
+const matrix_kernel_t* find_matrix_kernel(const char* name)
+{
+    for (size_t i = 0; i < num_matrix_kernels; ++i) {
+        if (!strcmp(matrix_kernels[i].name, name)) {
+            return &matrix_kernels[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Compares transpose_matrix() and its in-place variant against memcpy of the same matrix.
+// Each of them reads and writes dim*dim elements once.
+void bench_transpose(bench_t* bench, size_t dim)
+{
+    long* A = create_matrix(dim);
+    long* T = create_matrix(dim);
+    if (!A || !T) {
+        exit(EXIT_FAILURE);
+    }
+
+    init_matrix(A, dim, 0xA);
+    memset(T, 0, sizeof(long)*dim*dim);
+
+    double bytes = 2.0 * sizeof(long) * dim * dim;
+    double time = 0;
+    char label[64] = "";
+    perf_region_t perf;
+
+    snprintf(label, sizeof(label), "memcpy %zu", dim);
+    perf_region_begin(&perf, label);
+    perf_region_pause(&perf);
+    for (bench_start(bench, "%s", label); bench_running(bench); ) {
+        if (bench_timed(bench)) {
+            perf_region_resume(&perf);
+        }
+        bench_tic(bench);
+        memcpy(T, A, sizeof(long)*dim*dim);
+        bench_toc(bench);
+        perf_region_pause(&perf);
+    }
+    perf_region_end(&perf);
+    time = bench_report(bench, 0, dim*dim, bytes);
+    printf("%-10s %8zu %12lf %8.2lf GB/s\n", "memcpy", dim, time, bytes / time / 1e9);
+
+    snprintf(label, sizeof(label), "transpose %zu", dim);
+    perf_region_begin(&perf, label);
+    perf_region_pause(&perf);
+    for (bench_start(bench, "%s", label); bench_running(bench); ) {
+        if (bench_timed(bench)) {
+            perf_region_resume(&perf);
+        }
+        bench_tic(bench);
+        transpose_matrix(A, T, dim);
+        bench_toc(bench);
+        perf_region_pause(&perf);
+    }
+    perf_region_end(&perf);
+    time = bench_report(bench, 0, dim*dim, bytes);
+    printf("%-10s %8zu %12lf %8.2lf GB/s\n", "transpose", dim, time, bytes / time / 1e9);
+
+    // Every repetition transposes the original A
+    snprintf(label, sizeof(label), "inplace %zu", dim);
+    perf_region_begin(&perf, label);
+    perf_region_pause(&perf);
+    for (bench_start(bench, "%s", label); bench_running(bench); ) {
+        init_matrix(A, dim, 0xA);
+        if (bench_timed(bench)) {
+            perf_region_resume(&perf);
+        }
+        bench_tic(bench);
+        transpose_matrix_inplace(A, dim);
+        bench_toc(bench);
+        perf_region_pause(&perf);
+    }
+    perf_region_end(&perf);
+    time = bench_report(bench, 0, dim*dim, bytes);
+    printf("%-10s %8zu %12lf %8.2lf GB/s\n", "inplace", dim, time, bytes / time / 1e9);
+
+    if (memcmp(A, T, sizeof(long)*dim*dim)) {
+        printf("In-place and out-of-place transposes differ!\n");
+    }
+
+    delete_matrix(A, dim);
+    delete_matrix(T, dim);
+}
+
+// Best of MATRIX_TUNE_REPS runs of mul on a cleared C
+double _time_mul(void (*mul)(long*, long*, long*, size_t), long* A, long* B, long* C, size_t dim)
+{
+    double best = 1e30;
+
+    for (int rep = 0; rep < MATRIX_TUNE_REPS; ++rep) {
+        memset(C, 0, sizeof(long)*dim*dim);
+
+        double start = omp_get_wtime();
+        mul(A, B, C, dim);
+        double t = omp_get_wtime() - start;
+        best = t < best ? t : best;
+    }
+
+    return best;
+}
+
+// Searches one parameter at a time with short runs at dim, each search starting from
+// the winners of the previous ones, and stores the winners in the tune cache
+void tune_matrix(size_t dim)
+{
+    long* A = create_matrix(dim);
+    long* B = create_matrix(dim);
+    long* C = create_matrix(dim);
+    if (!A || !B || !C) {
+        exit(EXIT_FAILURE);
+    }
+    init_matrix(A, dim, 0xA);
+    init_matrix(B, dim, 0xB);
+
+    printf("Tuning for %s at dim %zu\n\n", tune_host(), dim);
+    printf("%-26s %10s %12s\n", "parameter", "value", "time");
+
+    // Threads, on the simd kernel which parallelizes over row blocks and column strips
+    const int num_procs = omp_get_num_procs();
+    int best_threads = 1;
+    double best = 1e30;
+    for (int threads = 1; threads <= num_procs; threads = (threads*2 > num_procs && threads < num_procs) ? num_procs : threads*2) {
+        omp_set_num_threads(threads);
+        enable_omp_parallel = threads > 1;
+
+        double t = _time_mul(simd_mul_matrix, A, B, C, dim);
+        printf("%-26s %10d %12lf\n", "matrix_threads", threads, t);
+        if (t < best) {
+            best = t;
+            best_threads = threads;
+        }
+    }
+    omp_set_num_threads(best_threads);
+    enable_omp_parallel = best_threads > 1;
+    tune_set("matrix_threads", best_threads);
+
+    // Schedule of the schedule(runtime) loops, also on the simd kernel
+    const omp_sched_t kinds[] = {omp_sched_static, omp_sched_dynamic, omp_sched_guided};
+    const int chunks[] = {1, 2, 4, 8};
+    omp_sched_t best_kind = omp_sched_dynamic;
+    int best_chunk = 1;
+    best = 1e30;
+    for (size_t i = 0; i < sizeof(kinds)/sizeof(kinds[0]); ++i) {
+        for (size_t j = 0; j < sizeof(chunks)/sizeof(chunks[0]); ++j) {
+            omp_set_schedule(kinds[i], chunks[j]);
+
+            double t = _time_mul(simd_mul_matrix, A, B, C, dim);
+            printf("%-26s %7s,%-2d %12lf\n", "matrix_schedule", tune_schedule_name(kinds[i]), chunks[j], t);
+            if (t < best) {
+                best = t;
+                best_kind = kinds[i];
+                best_chunk = chunks[j];
+            }
+        }
+    }
+    omp_set_schedule(best_kind, best_chunk);
+    tune_set("matrix_schedule", best_kind);
+    tune_set("matrix_chunk", best_chunk);
+
+    // Block size, block_gemm() handles the leftover edge blocks
+    size_t best_bs = matrix_mul_bs;
+    best = 1e30;
+    for (size_t bs = 16; bs <= 512 && bs <= dim; bs *= 2) {
+        matrix_mul_bs = bs;
+
+        double t = _time_mul(block_mul_matrix, A, B, C, dim);
+        printf("%-26s %10zu %12lf\n", "matrix_mul_bs", bs, t);
+        if (t < best) {
+            best = t;
+            best_bs = bs;
+        }
+    }
+    matrix_mul_bs = best_bs;
+    tune_set("matrix_mul_bs", best_bs);
+
+    // Cutoff of the classic Strassen kernels
+    size_t best_cutoff = matrix_fastmul_threshhold;
+    best = 1e30;
+    for (size_t cutoff = 32; cutoff <= 512 && cutoff < dim; cutoff *= 2) {
+        matrix_fastmul_threshhold = cutoff;
+
+        double t = _time_mul(arena_fast_mul_matrix, A, B, C, dim);
+        printf("%-26s %10zu %12lf\n", "matrix_fastmul_threshhold", cutoff, t);
+        if (t < best) {
+            best = t;
+            best_cutoff = cutoff;
+        }
+    }
+    matrix_fastmul_threshhold = best_cutoff;
+    tune_set("matrix_fastmul_threshhold", best_cutoff);
+
+    // Winograd crossover, with its own doubling search
+    matrix_winograd_threshhold = calibrate_winograd_threshhold(MATRIX_WINOGRAD_CALIBRATION_MAX);
+    printf("%-26s %10zu %12s\n", "matrix_winograd_threshhold", matrix_winograd_threshhold, "-");
+    tune_set("matrix_winograd_threshhold", matrix_winograd_threshhold);
+
+    printf("\nSaved to %s\n", tune_cache.path);
+
+    delete_matrix(A, dim);
+    delete_matrix(B, dim);
+    delete_matrix(C, dim);
+}
+
+// Multiplies count independent dim x dim matrices with every selected kernel called once per
+// matrix, then with the batched kernels on both layouts. Times of the interleaved kernel do not
+// include layout conversion, it is timed separately.
+void bench_batch(bench_t* bench, const matrix_kernel_t** kernels, size_t num_kernels, size_t dim, size_t count, int verify_rounds)
+{
+    const size_t size = dim*dim;
+    const size_t len = interleaved_batch_len(count, dim);
+
+    long* A = create_rect_matrix(count*dim, dim);
+    long* B = create_rect_matrix(count*dim, dim);
+    long* C = create_rect_matrix(count*dim, dim);
+    long* iA = create_buffer(sizeof(long)*len);
+    long* iB = create_buffer(sizeof(long)*len);
+    long* iC = create_buffer(sizeof(long)*len);
+    if (!A || !B || !C || !iA || !iB || !iC) {
+        exit(EXIT_FAILURE);
+    }
+
+    init_rect_matrix(A, count*dim, dim, 0xA);
+    init_rect_matrix(B, count*dim, dim, 0xB);
+
+    for (size_t kn = 0; kn <= num_kernels + 1; ++kn) {
+        char name[64] = "", label[96] = "";
+        double convert = 0;
+        perf_region_t perf;
+
+        if (kn < num_kernels) {
+            if (!kernels[kn]->mul) {
+                continue;
+            }
+            snprintf(name, sizeof(name), "loop-%s", kernels[kn]->name);
+            snprintf(label, sizeof(label), "%s %zux%zu", name, dim, count);
+            perf_region_begin(&perf, label);
+            perf_region_pause(&perf);
+            for (bench_start(bench, "%s", label); bench_running(bench); ) {
+                memset(C, 0, sizeof(long)*count*size);
+                if (bench_timed(bench)) {
+                    perf_region_resume(&perf);
+                }
+                bench_tic(bench);
+                for (size_t b = 0; b < count; ++b) {
+                    kernels[kn]->mul(&A[b*size], &B[b*size], &C[b*size], dim);
+                }
+                bench_toc(bench);
+                perf_region_pause(&perf);
+            }
+            perf_region_end(&perf);
+        } else if (kn == num_kernels) {
+            snprintf(name, sizeof(name), "batched");
+            snprintf(label, sizeof(label), "%s %zux%zu", name, dim, count);
+            perf_region_begin(&perf, label);
+            perf_region_pause(&perf);
+            for (bench_start(bench, "%s", label); bench_running(bench); ) {
+                memset(C, 0, sizeof(long)*count*size);
+                if (bench_timed(bench)) {
+                    perf_region_resume(&perf);
+                }
+                bench_tic(bench);
+                batch_mul_matrix(A, B, C, count, dim);
+                bench_toc(bench);
+                perf_region_pause(&perf);
+            }
+            perf_region_end(&perf);
+        } else {
+            snprintf(name, sizeof(name), "interleaved");
+
+            double convert_start = omp_get_wtime();
+            interleave_batch(A, iA, count, dim);
+            interleave_batch(B, iB, count, dim);
+            convert = omp_get_wtime() - convert_start;
+
+            snprintf(label, sizeof(label), "%s %zux%zu", name, dim, count);
+            perf_region_begin(&perf, label);
+            perf_region_pause(&perf);
+            for (bench_start(bench, "%s", label); bench_running(bench); ) {
+                memset(iC, 0, sizeof(long)*len);
+                if (bench_timed(bench)) {
+                    perf_region_resume(&perf);
+                }
+                bench_tic(bench);
+                interleaved_batch_mul_matrix(iA, iB, iC, count, dim);
+                bench_toc(bench);
+                perf_region_pause(&perf);
+            }
+            perf_region_end(&perf);
+
+            convert_start = omp_get_wtime();
+            deinterleave_batch(iC, C, count, dim);
+            convert += omp_get_wtime() - convert_start;
+        }
+        double time = bench_report(bench, 2.0*count*size*dim, count, 3.0*sizeof(long)*count*size);
+
+        const char* check = "-";
+        for (size_t b = 0; verify_rounds > 0 && b < count; ++b) {
+            check = "ok";
+            if (!verify_matrix(&A[b*size], &B[b*size], &C[b*size], dim, verify_rounds, 0xF)) {
+                check = "FAILED";
+                break;
+            }
+        }
+
+        printf("%-14s %6zu %8zu %12lf %12.3e %12lf %10x %8s\n", name, dim, count, time,
+               count / time, convert, hash_rect_matrix(C, count*dim, dim), check);
+    }
+
+    delete_rect_matrix(A, count*dim, dim);
+    delete_rect_matrix(B, count*dim, dim);
+    delete_rect_matrix(C, count*dim, dim);
+    delete_buffer(iA, sizeof(long)*len);
+    delete_buffer(iB, sizeof(long)*len);
+    delete_buffer(iC, sizeof(long)*len);
+}
+
+// C is m x n, A is m x k and B is k x n; square sizes have m = n = k
+typedef struct {
+    size_t m, n, k;
+} matrix_shape_t;
+
+// Tall-skinny, short-wide, low-rank and non-multiple shapes swept by --dim rect
+const matrix_shape_t rect_shapes[] = {
+    {16384, 64, 1024},
+    {64, 16384, 1024},
+    {4096, 4096, 64},
+    {1024, 1024, 16384},
+    {262144, 16, 16},
+    {1000, 999, 1001},
+};
+
+const size_t num_rect_shapes = sizeof(rect_shapes)/sizeof(rect_shapes[0]);
+
+// Parses "N" or "MxNxK", returns 0 on success
+int parse_shape(const char* item, matrix_shape_t* shape)
+{
+    char* end = NULL;
+    shape->m = shape->n = shape->k = strtoul(item, &end, 10);
+    if (*end == 'x') {
+        shape->n = strtoul(end + 1, &end, 10);
+        if (*end != 'x') {
+            return -1;
+        }
+        shape->k = strtoul(end + 1, &end, 10);
+    }
+
+    return *end != '\0' || !shape->m || !shape->n || !shape->k;
+}
+
+// "N" for square shapes, "MxNxK" otherwise
+void shape_name(char* buf, size_t size, const matrix_shape_t* shape)
+{
+    if (shape->m == shape->n && shape->n == shape->k) {
+        snprintf(buf, size, "%zu", shape->m);
+    } else {
+        snprintf(buf, size, "%zux%zux%zu", shape->m, shape->n, shape->k);
+    }
+}
+
+// DIR/<prefix>-<dim>.bin for square matrices, DIR/<prefix>-<rows>x<cols>.bin otherwise
+void shape_path(char* buf, size_t size, const char* dir, const char* prefix, size_t rows, size_t cols)
+{
+    if (rows == cols) {
+        snprintf(buf, size, "%s/%s-%zu.bin", dir, prefix, rows);
+    } else {
+        snprintf(buf, size, "%s/%s-%zux%zu.bin", dir, prefix, rows, cols);
+    }
+}
+
+void print_usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [options]\n", prog);
+    fprintf(stderr, "  -k, --kernel LIST        comma-separated kernels or \"all\" (default: %s)\n", MATRIX_DEFAULT_KERNEL);
+    fprintf(stderr, "  -n, --dim LIST           comma-separated sizes N or shapes MxNxK (C is MxN, A is MxK), \"rect\"\n");
+    fprintf(stderr, "                           adds a set of rectangular shapes (default: %d)\n", MATRIX_DIM);
+    fprintf(stderr, "      --alpha N, --beta N  compute C = alpha*A*B + beta*C, beta != 0 starts from a random C (default: 1, 0)\n");
+    fprintf(stderr, "  -b, --block-size N       block size for the block kernel (default: %d)\n", MATRIX_MUL_BS);
+    fprintf(stderr, "  -s, --strassen-cutoff N  size below which fast falls back to transpose (default: %d)\n", MATRIX_FASTMUL_THRESHHOLD);
+    fprintf(stderr, "  -w, --winograd-cutoff N  size below which winograd falls back to simd, 0 to measure it (default: %d)\n", MATRIX_WINOGRAD_THRESHHOLD);
+    fprintf(stderr, "  -t, --threads N          number of OpenMP threads, enables parallelization if N > 1\n");
+    fprintf(stderr, "  -v, --verify[=ROUNDS]    check every product with Freivalds' algorithm (default: %d rounds)\n", FREIVALDS_ROUNDS);
+    fprintf(stderr, "  -d, --data DIR           load A and B from DIR/{A,B}-<dim>.bin, generating them on first use\n");
+    fprintf(stderr, "  -S, --save-c             also save every C to DIR/C-<kernel>-<dim>.bin (needs --data)\n");
+    fprintf(stderr, "  -u, --tune[=DIM]         tune parameters for this host and save them to the tune cache (default dim: %d)\n", MATRIX_TUNE_DIM);
+    fprintf(stderr, "  -c, --batch COUNT        multiply COUNT independent matrices of every size instead of one\n");
+    fprintf(stderr, "  -T, --transpose          benchmark transpose bandwidth instead of multiplication\n");
+    fprintf(stderr, "  -l, --list               list available kernels\n");
+    fprintf(stderr, "  -h, --help               show this message\n");
+}
+
+// Splits comma-separated list in place, returns number of items
+size_t split_list(char* list, char** items, size_t max_items)
+{
+    size_t n = 0;
+    for (char* tok = strtok(list, ","); tok && n < max_items; tok = strtok(NULL, ",")) {
+        items[n++] = tok;
+    }
+
+    return n;
+}
+
+int main(int argc, char** argv)
+{
+    const matrix_kernel_t* kernels[MAX_SWEEP_LEN] = {0};
+    matrix_shape_t shapes[MAX_SWEEP_LEN] = {{MATRIX_DIM, MATRIX_DIM, MATRIX_DIM}};
+    size_t num_kernels = 0, num_shapes = 1;
+    long alpha = 1, beta = 0;
+    char* items[MAX_SWEEP_LEN] = {0};
+    int transpose_only = 0;
+    size_t batch_count = 0;
+    int verify_rounds = 0;
+    const char* data_dir = NULL;
+    int save_c = 0;
+
+    const struct option long_options[] = {
+        {"kernel", required_argument, NULL, 'k'},
+        {"dim", required_argument, NULL, 'n'},
+        {"alpha", required_argument, NULL, 'a'},
+        {"beta", required_argument, NULL, 'e'},
+        {"block-size", required_argument, NULL, 'b'},
+        {"strassen-cutoff", required_argument, NULL, 's'},
+        {"winograd-cutoff", required_argument, NULL, 'w'},
+        {"threads", required_argument, NULL, 't'},
+        {"verify", optional_argument, NULL, 'v'},
+        {"data", required_argument, NULL, 'd'},
+        {"save-c", no_argument, NULL, 'S'},
+        {"tune", optional_argument, NULL, 'u'},
+        {"batch", required_argument, NULL, 'c'},
+        {"transpose", no_argument, NULL, 'T'},
+        {"list", no_argument, NULL, 'l'},
+        {"help", no_argument, NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    matrix_mul_bs = tune_get("matrix_mul_bs", matrix_mul_bs);
+    matrix_fastmul_threshhold = tune_get("matrix_fastmul_threshhold", matrix_fastmul_threshhold);
+    matrix_winograd_threshhold = tune_get("matrix_winograd_threshhold", matrix_winograd_threshhold);
+    tune_apply_schedule("matrix");
+    // Serial builds stay serial unless --threads says otherwise
+    if (enable_omp_parallel && tune_get("matrix_threads", 0) > 0) {
+        omp_set_num_threads(tune_get("matrix_threads", 0));
+    }
+
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "k:n:b:s:w:t:v::d:Su::c:Tlh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'k':
+                if (!strcmp(optarg, "all")) {
+                    for (num_kernels = 0; num_kernels < num_matrix_kernels; ++num_kernels) {
+                        kernels[num_kernels] = &matrix_kernels[num_kernels];
+                    }
+                    break;
+                }
+
+                num_kernels = split_list(optarg, items, MAX_SWEEP_LEN);
+                for (size_t i = 0; i < num_kernels; ++i) {
+                    kernels[i] = find_matrix_kernel(items[i]);
+                    if (!kernels[i]) {
+                        fprintf(stderr, "Unknown kernel: %s (use --list)\n", items[i]);
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                break;
+            case 'n':
+                num_shapes = 0;
+                size_t num_items = split_list(optarg, items, MAX_SWEEP_LEN);
+                for (size_t i = 0; i < num_items; ++i) {
+                    if (!strcmp(items[i], "rect")) {
+                        for (size_t j = 0; j < num_rect_shapes && num_shapes < MAX_SWEEP_LEN; ++j) {
+                            shapes[num_shapes++] = rect_shapes[j];
+                        }
+                    } else if (num_shapes < MAX_SWEEP_LEN && parse_shape(items[i], &shapes[num_shapes++])) {
+                        fprintf(stderr, "Bad shape: %s (use N or MxNxK)\n", items[i]);
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                break;
+            case 'a':
+                alpha = atol(optarg);
+                break;
+            case 'e':
+                beta = atol(optarg);
+                break;
+            case 'b':
+                matrix_mul_bs = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                matrix_fastmul_threshhold = strtoul(optarg, NULL, 10);
+                break;
+            case 'w':
+                matrix_winograd_threshhold = strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                omp_set_num_threads(atoi(optarg));
+                enable_omp_parallel = atoi(optarg) > 1;
+                break;
+            case 'v':
+                verify_rounds = optarg ? atoi(optarg) : FREIVALDS_ROUNDS;
+                break;
+            case 'd':
+                data_dir = optarg;
+                break;
+            case 'S':
+                save_c = 1;
+                break;
+            case 'u':
+                tune_matrix(optarg ? strtoul(optarg, NULL, 10) : MATRIX_TUNE_DIM);
+                return 0;
+            case 'c':
+                batch_count = strtoul(optarg, NULL, 10);
+                break;
+            case 'T':
+                transpose_only = 1;
+                break;
+            case 'l':
+                for (size_t i = 0; i < num_matrix_kernels; ++i) {
+                    printf("%s\n", matrix_kernels[i].name);
+                }
+                return 0;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (save_c && !data_dir) {
+        fprintf(stderr, "--save-c needs --data\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bench_t bench;
+    bench_init(&bench, "matrix");
+    bench_set(&bench, "parallel", "%d", enable_omp_parallel);
+    bench_set(&bench, "block_size", "%zu", matrix_mul_bs);
+    bench_set(&bench, "isa", "%s", simd_isa_name());
+    printf("Times are medians of %d repetitions after %d warmup runs\n", bench.reps, bench.warmup);
+
+    if (transpose_only) {
+        printf("%-10s %8s %12s %16s\n", "operation", "dim", "time", "bandwidth");
+        for (size_t d = 0; d < num_shapes; ++d) {
+            bench_transpose(&bench, shapes[d].m);
+        }
+
+        return 0;
+    }
+
+    if (!num_kernels) {
+        kernels[num_kernels++] = find_matrix_kernel(MATRIX_DEFAULT_KERNEL);
+    }
+
     printf("Maximum element size: %d\n", MATRIX_ELEM_MAX);
+    print_tune_cache();
     if (enable_omp_parallel) {
-        printf("OpenMP parallelization enabled\n");
-    }
-
-    long* A = create_matrix(MATRIX_DIM);
-    long* B = create_matrix(MATRIX_DIM);
-    long* BT = create_matrix(MATRIX_DIM);
-    long* C = create_matrix(MATRIX_DIM);
-    // mlockall(MCL_CURRENT | MCL_FUTURE);
-
-    init_matrix(A, MATRIX_DIM, 0xA);
-    init_matrix(B, MATRIX_DIM, 0xB);
-    transpose_matrix(B, BT, MATRIX_DIM);
-
-    double start = omp_get_wtime();
-
-    #ifdef TRANSPOSE
-        printf("Using transposed_mul_matrix()\n");
-        transposed_mul_matrix(A, B, C, MATRIX_DIM);
-    #elif BLOCK
-        printf("Using block_mul_matrix()\n");
-        block_mul_matrix(A, B, C, MATRIX_DIM);
-    #elif SIMD
-        printf("Using simd_mul_matrix()\n");
-        simd_mul_matrix(A, BT, C, MATRIX_DIM);
-    #elif FAST
-        printf("Using fast_mul_matrix()\n");
-        fast_mul_matrix(A, B, C, MATRIX_DIM);
-    #else
-        printf("Using mul_matrix()\n");
-        mul_matrix(A, B, C, MATRIX_DIM);
-    #endif
+        omp_sched_t kind = omp_sched_static;
+        int chunk = 0;
+        omp_get_schedule(&kind, &chunk);
+        printf("OpenMP parallelization enabled, %d threads, schedule(runtime) is %s,%d\n", omp_get_max_threads(), tune_schedule_name(kind), chunk);
+    }
+    printf("Block size: %zu, Strassen cutoff: %zu\n", matrix_mul_bs, matrix_fastmul_threshhold);
+    if (alpha != 1 || beta != 0) {
+        printf("C = %ld*A*B + %ld*C\n", alpha, beta);
+    }
+    for (size_t k = 0; k < num_kernels; ++k) {
+        if (kernels[k]->mul == winograd_mul_matrix) {
+            size_t max_dim = 0;
+            for (size_t d = 0; d < num_shapes; ++d) {
+                max_dim = shapes[d].m > max_dim ? shapes[d].m : max_dim;
+            }
+
+            const char* how = "";
+            if (!matrix_winograd_threshhold) {
+                matrix_winograd_threshhold = calibrate_winograd_threshhold(max_dim);
+                how = " (measured)";
+            }
+            printf("Winograd cutoff: %zu%s\n", matrix_winograd_threshhold, how);
+            break;
+        }
+    }
+    printf("SIMD instruction set: %s\n", simd_isa_name());
+
+    if (batch_count) {
+        print_memory_policy();
+        printf("\n");
+        printf("%-14s %6s %8s %12s %12s %12s %10s %8s\n", "kernel", "dim", "count", "time", "matrices/s", "layout(s)", "hash(C)", "verify");
+        for (size_t d = 0; d < num_shapes; ++d) {
+            if (shapes[d].m != shapes[d].n || shapes[d].n != shapes[d].k) {
+                fprintf(stderr, "Batches are square only, skipping shape %zux%zux%zu\n", shapes[d].m, shapes[d].n, shapes[d].k);
+                continue;
+            }
+            bench_batch(&bench, kernels, num_kernels, shapes[d].m, batch_count, verify_rounds);
+        }
+
+        return 0;
+    }
+
+    for (size_t d = 0; d < num_shapes; ++d) {
+        const size_t m = shapes[d].m, n = shapes[d].n, k = shapes[d].k;
+        const int square = m == n && n == k;
+        char label[64] = "", path[PATH_MAX] = "";
+        shape_name(label, sizeof(label), &shapes[d]);
+
+        long* A = NULL, *B = NULL, *C0 = NULL;
+        if (data_dir) {
+            shape_path(path, sizeof(path), data_dir, "A", m, k);
+            A = open_rect_matrix(path, m, k, 0xA, 0);
+            shape_path(path, sizeof(path), data_dir, "B", k, n);
+            B = open_rect_matrix(path, k, n, 0xB, 0);
+        } else {
+            A = create_rect_matrix(m, k);
+            B = create_rect_matrix(k, n);
+            if (A && B) {
+                init_rect_matrix(A, m, k, 0xA);
+                init_rect_matrix(B, k, n, 0xB);
+            }
+        }
+
+        // Initial C for beta != 0, every kernel starts from a copy of it
+        if (beta) {
+            C0 = create_rect_matrix(m, n);
+            if (C0) {
+                init_rect_matrix(C0, m, n, 0xC);
+            }
+        }
+
+        long* C = create_rect_matrix(m, n);
+        if (!A || !B || !C || (beta && !C0)) {
+            exit(EXIT_FAILURE);
+        }
+        // mlockall(MCL_CURRENT | MCL_FUTURE);
+
+        if (d == 0) {
+            print_memory_policy();
+            printf("\n");
+            printf("%-10s %14s %12s %16s %10s %10s %8s\n", "kernel", "shape", "time", "rate", "mem(MiB)", "hash(C)", "verify");
+        }
 
-    double end = omp_get_wtime();
+        for (size_t kn = 0; kn < num_kernels; ++kn) {
+            const matrix_kernel_t* kernel = kernels[kn];
+            const matrix_type_t* type = kernel->type;
 
-    printf("\n");
-    printf("Multiplication time: %lf\n", end - start);
+            // Kernels without a GEMM form only compute square C = A*B
+            if (!kernel->gemm && (!square || alpha != 1 || beta != 0)) {
+                printf("%-10s %14s %12s (square C = A*B only)\n", kernel->name, label, "skipped");
+                continue;
+            }
+
+            void* tA = NULL, *tB = NULL, *tC = NULL;
+            if (type) {
+                tA = create_typed_matrix(m, type->elem_size);
+                tB = create_typed_matrix(m, type->elem_size);
+                tC = create_typed_matrix(m, type->acc_size);
+                if (!tA || !tB || !tC) {
+                    exit(EXIT_FAILURE);
+                }
+
+                type->convert(A, tA, m);
+                type->convert(B, tB, m);
+            }
 
-    printf("hash(A) = %x\n", hash_matrix(A, MATRIX_DIM));
-    printf("hash(B) = %x\n", hash_matrix(B, MATRIX_DIM));
-    printf("hash(C) = %x\n", hash_matrix(C, MATRIX_DIM));
+            reset_peak_memory();
+            size_t rss = get_memory_kb("VmRSS:");
+
+            char perf_label[96] = "";
+            perf_region_t perf;
+            snprintf(perf_label, sizeof(perf_label), "%s %s", kernel->name, label);
+            perf_region_begin(&perf, perf_label);
+            perf_region_pause(&perf);
+
+            // Every repetition starts from the same C
+            for (bench_start(&bench, "%s", perf_label); bench_running(&bench); ) {
+                if (type) {
+                    memset(tC, 0, type->acc_size*m*m);
+                } else if (C0) {
+                    memcpy(C, C0, sizeof(long)*m*n);
+                } else {
+                    memset(C, 0, sizeof(long)*m*n);
+                }
+
+                if (bench_timed(&bench)) {
+                    perf_region_resume(&perf);
+                }
+                bench_tic(&bench);
+                if (type) {
+                    type->mul(tA, tB, tC, m);
+                } else if (kernel->gemm) {
+                    kernel->gemm(m, n, k, alpha, A, k, B, n, beta, C, n);
+                } else {
+                    kernel->mul(A, B, C, m);
+                }
+                bench_toc(&bench);
+                perf_region_pause(&perf);
+            }
+            perf_region_end(&perf);
+
+            const size_t elem_size = type ? type->elem_size : sizeof(long);
+            const size_t acc_size = type ? type->acc_size : sizeof(long);
+            double time = bench_report(&bench, 2.0*m*n*k, (double)m*n,
+                                       (double)elem_size*(m*k + k*n) + (double)acc_size*m*n*(beta ? 2 : 1));
+
+            // Extra memory the kernel needed on top of its inputs and C
+            double mem = (get_memory_kb("VmHWM:") - (double)rss) / 1024;
+            double gops = 2.0*m*n*k / time / 1e9;
+            const char* unit = (type && type->is_float) ? "GFLOP/s" : "GOP/s";
+            unsigned int hash = type ? type->hash(tC, m) : hash_rect_matrix(C, m, n);
+
+            if (type && (verify_rounds > 0 || save_c)) {
+                type->widen(tC, C, m);
+            }
+
+            const char* check = "-";
+            if (verify_rounds > 0) {
+                check = verify_gemm(A, B, C, C0, m, n, k, alpha, beta, verify_rounds, 0xF) ? "ok" : "FAILED";
+            }
+
+            printf("%-10s %14s %12lf %8.2lf %-7s %10.1lf %10x %8s\n", kernel->name, label, time, gops, unit, mem, hash, check);
+
+            if (save_c) {
+                snprintf(path, sizeof(path), "%s/C-%s-%s.bin", data_dir, kernel->name, label);
+                save_rect_matrix(path, C, m, n);
+            }
+
+            if (type) {
+                delete_typed_matrix(tA, m, type->elem_size);
+                delete_typed_matrix(tB, m, type->elem_size);
+                delete_typed_matrix(tC, m, type->acc_size);
+            }
+        }
+
+        if (data_dir) {
+            close_rect_matrix(A, m, k);
+            close_rect_matrix(B, k, n);
+        } else {
+            delete_rect_matrix(A, m, k);
+            delete_rect_matrix(B, k, n);
+        }
+        if (C0) {
+            delete_rect_matrix(C0, m, n);
+        }
+        delete_rect_matrix(C, m, n);
+    }
 
     return 0;
 }
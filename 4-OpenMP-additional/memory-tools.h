@@ -0,0 +1,208 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+/*
+    Allocation layer for large benchmark buffers. The policy is read once
+    from the MEMORY_POLICY environment variable, a comma-separated list of:
+
+        thp         transparent huge pages via madvise(MADV_HUGEPAGE)
+        hugetlb     explicit huge pages via MAP_HUGETLB, falls back to thp
+        interleave  spread pages round-robin over all NUMA nodes (mbind)
+        touch       parallel first touch with schedule(static), so pages land
+                    on the node of the thread that will use them in kernels
+                    with the same static schedule
+        populate    prefault all pages right away from one thread
+
+    Without MEMORY_POLICY buffers are plain anonymous mappings, first
+    touched by whoever writes them first.
+*/
+
+enum {
+        MEMORY_THP = 1 << 0,
+        MEMORY_HUGETLB = 1 << 1,
+        MEMORY_INTERLEAVE = 1 << 2,
+        MEMORY_TOUCH = 1 << 3,
+        MEMORY_POPULATE = 1 << 4,
+        HUGE_PAGE_SIZE = 2 << 20
+    };
+
+typedef struct {
+    int initialized;
+    int requested;
+    size_t buffers;
+    size_t hugetlb_fallbacks;
+    size_t interleave_failures;
+} memory_policy_t;
+
+memory_policy_t memory_policy = {0};
+
+int get_memory_policy()
+{
+    if (memory_policy.initialized) {
+        return memory_policy.requested;
+    }
+
+    const char* names[] = {"thp", "hugetlb", "interleave", "touch", "populate"};
+    const char* env = getenv("MEMORY_POLICY");
+    memory_policy.initialized = 1;
+
+    if (!env) {
+        return 0;
+    }
+
+    char* list = strdup(env);
+    for (char* tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+        int known = 0;
+        for (int i = 0; i < 5; ++i) {
+            if (!strcmp(tok, names[i])) {
+                memory_policy.requested |= 1 << i;
+                known = 1;
+            }
+        }
+        if (!known) {
+            fprintf(stderr, "Unknown MEMORY_POLICY item: %s\n", tok);
+        }
+    }
+    free(list);
+
+    return memory_policy.requested;
+}
+
+// Huge page policies round every mapping up to whole huge pages
+size_t _buffer_map_size(size_t bytes)
+{
+    if (get_memory_policy() & (MEMORY_THP|MEMORY_HUGETLB)) {
+        return (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    }
+
+    return bytes;
+}
+
+// Sets MPOL_INTERLEAVE over all possible NUMA nodes for the range
+int _interleave_buffer(void* ptr, size_t size)
+{
+    unsigned long nodemask = 0;
+    unsigned int first = 0, last = 0;
+
+    FILE* file = fopen("/sys/devices/system/node/possible", "r");
+    if (!file) {
+        return -1;
+    }
+    int n = fscanf(file, "%u-%u", &first, &last);
+    fclose(file);
+
+    if (n < 1) {
+        return -1;
+    }
+    if (n == 1) {
+        last = first;
+    }
+    for (unsigned int node = first; node <= last && node < 8*sizeof(nodemask); ++node) {
+        nodemask |= 1ul << node;
+    }
+
+    return syscall(SYS_mbind, ptr, size, MPOL_INTERLEAVE, &nodemask, 8*sizeof(nodemask), 0);
+}
+
+// Writes one byte per page from all threads with the same static schedule the kernels use
+void _touch_buffer(char* ptr, size_t size)
+{
+    const size_t page = (get_memory_policy() & (MEMORY_THP|MEMORY_HUGETLB)) ? HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+    const size_t num_pages = (size + page - 1) / page;
+
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < num_pages; ++i) {
+        ptr[i*page] = 0;
+    }
+}
+
+void* create_buffer(size_t bytes)
+{
+    const int policy = get_memory_policy();
+    const size_t size = _buffer_map_size(bytes);
+    const int prot_flags = PROT_READ|PROT_WRITE;
+    const int map_flags = MAP_PRIVATE|MAP_ANON;
+
+    void* ptr = MAP_FAILED;
+    if (policy & MEMORY_HUGETLB) {
+        ptr = mmap(NULL, size, prot_flags, map_flags|MAP_HUGETLB, -1, 0);
+        if (ptr == MAP_FAILED) {
+            memory_policy.hugetlb_fallbacks++;
+        }
+    }
+    if (ptr == MAP_FAILED) {
+        ptr = mmap(NULL, size, prot_flags, map_flags, -1, 0);
+    }
+    if (ptr == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    if (policy & (MEMORY_THP|MEMORY_HUGETLB)) {
+        madvise(ptr, size, MADV_HUGEPAGE);  // no-op for hugetlb mappings
+    }
+    if ((policy & MEMORY_INTERLEAVE) && _interleave_buffer(ptr, size)) {
+        memory_policy.interleave_failures++;
+    }
+    // Pages are faulted in only after huge page and NUMA advice is in place
+    if (policy & MEMORY_TOUCH) {
+        _touch_buffer((char*)ptr, size);
+    } else if (policy & MEMORY_POPULATE) {
+#ifdef MADV_POPULATE_WRITE
+        if (madvise(ptr, size, MADV_POPULATE_WRITE))  // Linux 5.14+
+#endif
+            memset(ptr, 0, size);
+    }
+
+    memory_policy.buffers++;
+    return ptr;
+}
+
+void delete_buffer(void* ptr, size_t bytes)
+{
+    munmap(ptr, _buffer_map_size(bytes));
+}
+
+// Reads a "Field: N kB" line from a /proc file
+size_t _read_proc_kb(const char* path, const char* field)
+{
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return 0;
+    }
+
+    char line[256] = "";
+    size_t value = 0;
+    while (fgets(line, sizeof(line), file)) {
+        if (!strncmp(line, field, strlen(field))) {
+            value = strtoul(line + strlen(field), NULL, 10);
+            break;
+        }
+    }
+
+    fclose(file);
+    return value;
+}
+
+// Reports the requested policy and what actually happened so far
+void print_memory_policy()
+{
+    const char* env = getenv("MEMORY_POLICY");
+    get_memory_policy();
+
+    printf("Memory policy: %s", env && *env ? env : "default");
+    if (memory_policy.hugetlb_fallbacks) {
+        printf(", MAP_HUGETLB failed for %zu of %zu buffers (used thp)", memory_policy.hugetlb_fallbacks, memory_policy.buffers);
+    }
+    if (memory_policy.interleave_failures) {
+        printf(", mbind failed for %zu of %zu buffers", memory_policy.interleave_failures, memory_policy.buffers);
+    }
+    printf(", huge pages in use: %zu MiB\n", _read_proc_kb("/proc/self/smaps_rollup", "AnonHugePages:") / 1024);
+}
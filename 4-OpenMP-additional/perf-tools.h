@@ -0,0 +1,331 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "bench-tools.h"
+#ifdef _OPENMP
+    #include <omp.h>
+#endif
+
+/*
+    Hardware counters around timed regions, read with perf_event_open(2).
+    Collection is off unless the PERF_COUNTERS environment variable is set.
+    Every region then emits one JSON line per thread plus one with the sum:
+
+        {"region": "...", "thread": 0, "seconds": ..., "cycles": ..., ...}
+
+    to stderr like the records of bench-tools.h, so result tables on stdout
+    stay readable, or appended to the file named by PERF_OUTPUT.
+
+    In OpenMP programs every thread of the team opens counters on itself in a
+    parallel region, so the following parallel regions of the same size run
+    on the same (pooled) threads and are counted per thread. Without OpenMP
+    the calling thread counts with inherit set, which includes threads it
+    creates later (std::thread), but only as one total.
+
+    perf_region_pause() and perf_region_resume() stop and restart all
+    counters of a region, so a benchmark loop counts only its timed calls
+    and a region reports the sum over them (seconds included):
+
+        perf_region_begin(&perf, "sort");
+        perf_region_pause(&perf);
+        for (bench_start(&bench, "sort"); bench_running(&bench); ) {
+            init_array(...);                // setup, not counted
+            if (bench_timed(&bench)) {      // nor are warmups
+                perf_region_resume(&perf);
+            }
+            bench_tic(&bench);
+            sort(...);
+            bench_toc(&bench);
+            perf_region_pause(&perf);
+        }
+        perf_region_end(&perf);
+
+    Events the host does not have (VMs, containers, perf_event_paranoid > 2)
+    are reported as null; task_clock is a software event and always works.
+    cycles / task_clock is the average clock frequency while running.
+*/
+
+enum {
+        PERF_CYCLES = 0,
+        PERF_INSTRUCTIONS,
+        PERF_L1D_MISSES,
+        PERF_LLC_MISSES,
+        PERF_DTLB_MISSES,
+        PERF_BRANCH_MISSES,
+        PERF_TASK_CLOCK,
+        PERF_NUM_EVENTS,
+        PERF_NAME_LEN = 128
+    };
+
+typedef struct {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+} perf_event_t;
+
+#define PERF_READ_MISSES(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+const perf_event_t perf_events[PERF_NUM_EVENTS] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"l1d_misses", PERF_TYPE_HW_CACHE, PERF_READ_MISSES(PERF_COUNT_HW_CACHE_L1D)},
+    {"llc_misses", PERF_TYPE_HW_CACHE, PERF_READ_MISSES(PERF_COUNT_HW_CACHE_LL)},
+    {"dtlb_misses", PERF_TYPE_HW_CACHE, PERF_READ_MISSES(PERF_COUNT_HW_CACHE_DTLB)},
+    {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"task_clock_ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+};
+
+typedef struct {
+    int fd[PERF_NUM_EVENTS];
+    double value[PERF_NUM_EVENTS];  // scaled for multiplexing, < 0 if unavailable
+} perf_counters_t;
+
+typedef struct {
+    char name[PERF_NAME_LEN];
+    int num_threads;
+    perf_counters_t* threads;
+    int running;
+    double start;
+    double seconds;     // counted time, summed over the resumed intervals
+} perf_region_t;
+
+typedef struct {
+    int initialized;
+    int enabled;
+    int warned[PERF_NUM_EVENTS];
+    FILE* output;
+} perf_state_t;
+
+perf_state_t perf_state = {0, 0, {0}, NULL};
+
+int perf_enabled()
+{
+    if (perf_state.initialized) {
+        return perf_state.enabled;
+    }
+    perf_state.initialized = 1;
+
+    const char* env = getenv("PERF_COUNTERS");
+    perf_state.enabled = env && *env && strcmp(env, "0");
+    perf_state.output = stderr;
+
+    const char* path = getenv("PERF_OUTPUT");
+    if (perf_state.enabled && path && *path) {
+        perf_state.output = fopen(path, "a");
+        if (!perf_state.output) {
+            perror("fopen");
+            perf_state.output = stderr;
+        }
+    }
+
+    return perf_state.enabled;
+}
+
+double _perf_now()
+{
+    struct timespec ts = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Opens and starts all events on the calling thread
+void _perf_open_counters(perf_counters_t* counters, int inherit)
+{
+    for (int e = 0; e < PERF_NUM_EVENTS; ++e) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perf_events[e].type;
+        attr.config = perf_events[e].config;
+        attr.disabled = 1;
+        attr.inherit = inherit;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        counters->fd[e] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if (counters->fd[e] < 0) {
+            int err = errno;
+            const char* hint = (err == EACCES || err == EPERM) ? ", check /proc/sys/kernel/perf_event_paranoid" :
+                               (err == ENOENT || err == EOPNOTSUPP) ? ", no such counter on this CPU or VM" : "";
+#ifdef _OPENMP
+            #pragma omp critical(perf_warning)
+#endif
+            if (!perf_state.warned[e]) {
+                perf_state.warned[e] = 1;
+                fprintf(stderr, "perf: %s unavailable (%s%s)\n", perf_events[e].name, strerror(err), hint);
+            }
+        }
+    }
+
+    for (int e = 0; e < PERF_NUM_EVENTS; ++e) {
+        if (counters->fd[e] >= 0) {
+            ioctl(counters->fd[e], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters->fd[e], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+// Stops, reads and closes the events of the calling thread
+void _perf_close_counters(perf_counters_t* counters)
+{
+    for (int e = 0; e < PERF_NUM_EVENTS; ++e) {
+        if (counters->fd[e] >= 0) {
+            ioctl(counters->fd[e], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+
+    for (int e = 0; e < PERF_NUM_EVENTS; ++e) {
+        uint64_t data[3] = {0, 0, 0};  // value, time enabled, time running
+        counters->value[e] = -1;
+
+        if (counters->fd[e] < 0) {
+            continue;
+        }
+        // Events that shared the PMU with others ran only part of the time
+        if (read(counters->fd[e], data, sizeof(data)) == sizeof(data) && data[2]) {
+            counters->value[e] = (double)data[0] * data[1] / data[2];
+        }
+        close(counters->fd[e]);
+    }
+}
+
+void perf_region_begin(perf_region_t* region, const char* name)
+{
+    memset(region, 0, sizeof(*region));
+    snprintf(region->name, sizeof(region->name), "%s", name);
+
+    if (perf_enabled()) {
+#ifdef _OPENMP
+        region->num_threads = omp_get_max_threads();
+        region->threads = (perf_counters_t*)calloc(region->num_threads, sizeof(perf_counters_t));
+
+        #pragma omp parallel num_threads(region->num_threads)
+        _perf_open_counters(&region->threads[omp_get_thread_num()], 0);
+#else
+        region->num_threads = 1;
+        region->threads = (perf_counters_t*)calloc(1, sizeof(perf_counters_t));
+        _perf_open_counters(&region->threads[0], 1);
+#endif
+    }
+
+    region->running = 1;
+    region->start = _perf_now();
+}
+
+// Enables or disables every counter of the region, from any thread
+void _perf_region_ioctl(perf_region_t* region, unsigned long request)
+{
+    for (int t = 0; region->threads && t < region->num_threads; ++t) {
+        for (int e = 0; e < PERF_NUM_EVENTS; ++e) {
+            if (region->threads[t].fd[e] >= 0) {
+                ioctl(region->threads[t].fd[e], request, 0);
+            }
+        }
+    }
+}
+
+void perf_region_pause(perf_region_t* region)
+{
+    if (region->running) {
+        _perf_region_ioctl(region, PERF_EVENT_IOC_DISABLE);
+        region->seconds += _perf_now() - region->start;
+        region->running = 0;
+    }
+}
+
+void perf_region_resume(perf_region_t* region)
+{
+    if (!region->running) {
+        region->running = 1;
+        region->start = _perf_now();
+        _perf_region_ioctl(region, PERF_EVENT_IOC_ENABLE);
+    }
+}
+
+void _perf_print_value(FILE* out, const char* name, double value)
+{
+    if (value < 0) {
+        fprintf(out, ", \"%s\": null", name);
+    } else {
+        fprintf(out, ", \"%s\": %.0lf", name, value);
+    }
+}
+
+void _perf_print_record(const perf_region_t* region, int thread, const perf_counters_t* counters)
+{
+    FILE* out = perf_state.output;
+    const double* v = counters->value;
+
+    fprintf(out, "{\"region\": ");
+    _bench_print_string(out, region->name, '\\');
+    if (thread < 0) {
+        fprintf(out, ", \"thread\": \"all\", \"threads\": %d", region->num_threads);
+    } else {
+        fprintf(out, ", \"thread\": %d", thread);
+    }
+    fprintf(out, ", \"seconds\": %.9lf", region->seconds);
+
+    for (int e = 0; e < PERF_NUM_EVENTS; ++e) {
+        _perf_print_value(out, perf_events[e].name, v[e]);
+    }
+
+    if (v[PERF_CYCLES] > 0 && v[PERF_INSTRUCTIONS] >= 0) {
+        fprintf(out, ", \"ipc\": %.3lf", v[PERF_INSTRUCTIONS] / v[PERF_CYCLES]);
+    } else {
+        fprintf(out, ", \"ipc\": null");
+    }
+    if (v[PERF_CYCLES] >= 0 && v[PERF_TASK_CLOCK] > 0) {
+        fprintf(out, ", \"ghz\": %.3lf", v[PERF_CYCLES] / v[PERF_TASK_CLOCK]);
+    } else {
+        fprintf(out, ", \"ghz\": null");
+    }
+    fprintf(out, "}\n");
+}
+
+// Stops the counters and prints the per-thread and total records of the region
+void perf_region_end(perf_region_t* region)
+{
+    perf_region_pause(region);
+
+    if (!region->threads) {
+        return;
+    }
+
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(region->num_threads)
+    _perf_close_counters(&region->threads[omp_get_thread_num()]);
+#else
+    _perf_close_counters(&region->threads[0]);
+#endif
+
+    // An event counts in the total only if every thread had it
+    perf_counters_t total;
+    memset(&total, 0, sizeof(total));
+    for (int t = 0; t < region->num_threads; ++t) {
+        for (int e = 0; e < PERF_NUM_EVENTS; ++e) {
+            const double v = region->threads[t].value[e];
+            total.value[e] = (v < 0 || total.value[e] < 0) ? -1 : total.value[e] + v;
+        }
+    }
+
+    for (int t = 0; t < region->num_threads && region->num_threads > 1; ++t) {
+        _perf_print_record(region, t, &region->threads[t]);
+    }
+    _perf_print_record(region, -1, &total);
+    fflush(perf_state.output);
+
+    free(region->threads);
+    region->threads = NULL;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Counter-based generator: element i of a stream is a pure function of
+    (seed, i), so fills can be split between any number of threads and
+    still produce the same data. This is the SplitMix64 sequence evaluated
+    at an arbitrary position instead of stepped through serially.
+*/
+
+#define SPLITMIX64_GAMMA 0x9E3779B97F4A7C15ull
+
+uint64_t splitmix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    x ^= x >> 31;
+
+    return x;
+}
+
+// i-th 64-bit random number of the stream selected by seed
+uint64_t random_at(uint64_t seed, uint64_t i)
+{
+    return splitmix64(splitmix64(seed) + (i + 1)*SPLITMIX64_GAMMA);
+}
+
+// Maps a random number to [0, max) with a multiply-shift instead of a division
+long random_below(uint64_t x, long max)
+{
+    return (long)(((x >> 32) * (uint64_t)max) >> 32);
+}
+
+// arr[i] = random_below(random_at(seed, i), max), independent of thread count
+void fill_random(long* arr, size_t len, unsigned int seed, long max)
+{
+    const uint64_t key = splitmix64(seed);
+
+    #pragma omp parallel for simd schedule(static)
+    for (size_t i = 0; i < len; ++i) {
+        arr[i] = random_below(splitmix64(key + (i + 1)*SPLITMIX64_GAMMA), max);
+    }
+}
@@ -0,0 +1,397 @@
+#include "matrix-tools.h"
+#include "matrix-kernels.h"
+#include "array-tools.h"
+#include "sort-kernels.h"
+#include "bench-tools.h"
+#include <getopt.h>
+#include <string.h>
+#include <omp.h>
+
+/*
+    Roofline of this host: STREAM copy/scale/add/triad bandwidth for every
+    thread count, peak int64 multiply-add and f64 FMA throughput, and the
+    kernels placed on the roof by their operation count and bytes moved.
+
+    A kernel at arithmetic intensity AI (operations per byte of memory
+    traffic) can reach at most min(peak, AI * bandwidth). Below the ridge
+    point peak / bandwidth it is bandwidth-bound, above it compute-bound;
+    achieved / roof says how much is left to gain.
+
+    Byte counts are models of DRAM traffic, not measurements:
+      block    every bs x bs block of A and B is read and the C block is read
+               and written once per block triple, 32 * bs^2 * (n/bs)^3
+      merge    both halves read, the other buffer written, 16 * len
+      sort     one merge pass per level above the leaves plus the leaf pass,
+               each reading and writing every element once
+      avg      the array read once, 8 * len
+    Operations are multiply-adds counted as 2 for block, one compare per
+    merged element for merge and sort, one add per element for avg; the long
+    kernels are held against the int64 peak.
+*/
+
+#ifndef ROOFLINE_STREAM_LEN
+    #define ROOFLINE_STREAM_LEN (1 << 25)
+#endif
+#ifndef ROOFLINE_MATRIX_DIM
+    #define ROOFLINE_MATRIX_DIM 1024
+#endif
+#ifndef ROOFLINE_SORT_LEN
+    #define ROOFLINE_SORT_LEN (1 << 24)
+#endif
+#ifndef ROOFLINE_PEAK_ITERS
+    #define ROOFLINE_PEAK_ITERS 10000000
+#endif
+
+enum {
+        // Independent accumulators per thread, enough chains to hide FMA latency on two ports
+        ROOFLINE_ACCS = 64,
+        STREAM_COPY = 0,
+        STREAM_SCALE,
+        STREAM_ADD,
+        STREAM_TRIAD,
+        STREAM_NUM_KERNELS
+    };
+
+const char* stream_names[STREAM_NUM_KERNELS] = {"copy", "scale", "add", "triad"};
+// Bytes per element, without write-allocate traffic, as STREAM counts them
+const double stream_bytes[STREAM_NUM_KERNELS] = {16, 16, 24, 24};
+
+typedef struct {
+    double bandwidth;   // best STREAM bandwidth at the kernel thread count, GB/s
+    double peak_int;    // int64 multiply-add, GOP/s
+    double peak_float;  // f64 FMA, GFLOP/s
+} roofline_t;
+
+void stream_kernel(int kernel, double* restrict a, double* restrict b, double* restrict c, size_t len, int threads)
+{
+    const double q = 3.0;
+
+    switch (kernel) {
+        case STREAM_COPY:
+            #pragma omp parallel for num_threads(threads) schedule(static)
+                for (size_t i = 0; i < len; ++i) {
+                    c[i] = a[i];
+                }
+            break;
+        case STREAM_SCALE:
+            #pragma omp parallel for num_threads(threads) schedule(static)
+                for (size_t i = 0; i < len; ++i) {
+                    b[i] = q * c[i];
+                }
+            break;
+        case STREAM_ADD:
+            #pragma omp parallel for num_threads(threads) schedule(static)
+                for (size_t i = 0; i < len; ++i) {
+                    c[i] = a[i] + b[i];
+                }
+            break;
+        case STREAM_TRIAD:
+            #pragma omp parallel for num_threads(threads) schedule(static)
+                for (size_t i = 0; i < len; ++i) {
+                    a[i] = b[i] + q * c[i];
+                }
+            break;
+    }
+}
+
+// acc = acc*m + a on ROOFLINE_ACCS independent lanes, kept in registers, 2 operations per lane
+__attribute__((target_clones("arch=skylake-avx512", "arch=haswell", "default")))
+double _peak_float_thread(size_t iters)
+{
+    double acc[ROOFLINE_ACCS];
+    const double m = 0.999999, a = 1e-3;
+
+    for (int j = 0; j < ROOFLINE_ACCS; ++j) {
+        acc[j] = j;
+    }
+    for (size_t it = 0; it < iters; ++it) {
+        for (int j = 0; j < ROOFLINE_ACCS; ++j) {
+            acc[j] = acc[j] * m + a;
+        }
+    }
+
+    double sum = 0;
+    for (int j = 0; j < ROOFLINE_ACCS; ++j) {
+        sum += acc[j];
+    }
+
+    return sum;
+}
+
+// Same chains on int64, the operation of the long GEMM kernels (emulated multiply below AVX-512)
+__attribute__((target_clones("arch=skylake-avx512", "arch=haswell", "default")))
+long _peak_int_thread(size_t iters, long m, long a)
+{
+    long acc[ROOFLINE_ACCS];
+
+    for (int j = 0; j < ROOFLINE_ACCS; ++j) {
+        acc[j] = j;
+    }
+    for (size_t it = 0; it < iters; ++it) {
+        for (int j = 0; j < ROOFLINE_ACCS; ++j) {
+            acc[j] = acc[j] * m + a;
+        }
+    }
+
+    long sum = 0;
+    for (int j = 0; j < ROOFLINE_ACCS; ++j) {
+        sum += acc[j];
+    }
+
+    return sum;
+}
+
+// Probe operands read at run time: with a constant multiplier the compiler turns the
+// integer multiply into shifts and adds, and the probe no longer measures multiplies
+volatile long roofline_int_operands[2] = {3, 7};
+
+// Best rate of all threads running the probe at once, in G operations per second
+double measure_peak(bench_t* bench, int is_float, size_t iters, int threads)
+{
+    volatile double sink = 0;
+    const long m = roofline_int_operands[0], a = roofline_int_operands[1];
+
+    for (bench_start(bench, "peak %s %dt", is_float ? "f64-fma" : "i64-muladd", threads); bench_running(bench); ) {
+        bench_tic(bench);
+        #pragma omp parallel num_threads(threads)
+        {
+            double result = is_float ? _peak_float_thread(iters) : (double)_peak_int_thread(iters, m, a);
+            #pragma omp atomic
+                sink += result;
+        }
+        bench_toc(bench);
+    }
+
+    const double ops = 2.0 * ROOFLINE_ACCS * iters * threads;
+    bench_report(bench, ops, 0, 0);
+
+    return ops / bench->min / 1e9;
+}
+
+// STREAM reports the best repetition, so do the probes: it is the sustainable ceiling
+double measure_stream(bench_t* bench, int kernel, double* a, double* b, double* c, size_t len, int threads)
+{
+    for (bench_start(bench, "stream %s %dt", stream_names[kernel], threads); bench_running(bench); ) {
+        bench_tic(bench);
+        stream_kernel(kernel, a, b, c, len, threads);
+        bench_toc(bench);
+    }
+    bench_report(bench, 0, len, stream_bytes[kernel] * len);
+
+    return stream_bytes[kernel] * len / bench->min / 1e9;
+}
+
+void print_kernel(const roofline_t* roof, const char* name, double ops, double bytes, double time)
+{
+    const double ai = ops / bytes;
+    const double ridge = roof->peak_int / roof->bandwidth;
+    const double achieved = ops / time / 1e9;
+    const double ceiling = (ai * roof->bandwidth < roof->peak_int) ? ai * roof->bandwidth : roof->peak_int;
+
+    printf("%-10s %10.3lf %10.3lf %10.3lf %10.2lf %10.2lf %10.2lf %7.1lf%% %8s %8.1lfx\n", name, ops / 1e9,
+           bytes / 1e9, ai, achieved, bytes / time / 1e9, ceiling, 100 * achieved / ceiling,
+           ai < ridge ? "memory" : "compute", ceiling / achieved);
+}
+
+void roofline_kernels(bench_t* bench, const roofline_t* roof, size_t dim, size_t len)
+{
+    printf("\n");
+    printf("%-10s %10s %10s %10s %10s %10s %10s %8s %8s %9s\n", "kernel", "Gop", "GB", "op/B",
+           "Gop/s", "GB/s", "roof", "of roof", "bound", "headroom");
+
+    // block_mul_matrix, parallel over block rows
+    long* A = create_matrix(dim);
+    long* B = create_matrix(dim);
+    long* C = create_matrix(dim);
+    if (!A || !B || !C) {
+        exit(EXIT_FAILURE);
+    }
+    init_matrix(A, dim, 0xA);
+    init_matrix(B, dim, 0xB);
+
+    const double bs = matrix_mul_bs < dim ? matrix_mul_bs : dim;
+    const double blocks = (double)((dim + matrix_mul_bs - 1) / matrix_mul_bs);
+    for (bench_start(bench, "block %zu", dim); bench_running(bench); ) {
+        memset(C, 0, sizeof(long)*dim*dim);
+        bench_tic(bench);
+        block_mul_matrix(A, B, C, dim);
+        bench_toc(bench);
+    }
+    const double block_ops = 2.0 * dim * dim * dim, block_bytes = 32.0 * bs * bs * blocks * blocks * blocks;
+    print_kernel(roof, "block", block_ops, block_bytes, bench_report(bench, block_ops, (double)dim*dim, block_bytes));
+
+    delete_matrix(A, dim);
+    delete_matrix(B, dim);
+    delete_matrix(C, dim);
+
+    // _merge of two sorted halves, the top level of merge_sort()
+    long* array = create_array(len);
+    long* sorted = create_array(len);
+    if (!array || !sorted) {
+        exit(EXIT_FAILURE);
+    }
+    init_array(sorted, len, 0xA77);
+    merge_sort(sorted, len/2, MERGE_SORT_THRESHHOLD);
+    merge_sort(sorted + len/2, len - len/2, MERGE_SORT_THRESHHOLD);
+
+    for (bench_start(bench, "merge %zu", len); bench_running(bench); ) {
+        bench_tic(bench);
+        _merge(sorted, array, 0, len/2, len);
+        bench_toc(bench);
+    }
+    print_kernel(roof, "merge", len, 16.0 * len, bench_report(bench, len, len, 16.0 * len));
+
+    // merge_sort() from random input
+    size_t levels = 0;
+    for (size_t run = MERGE_SORT_THRESHHOLD; run < len; run *= 2) {
+        ++levels;
+    }
+    for (bench_start(bench, "merge_sort %zu", len); bench_running(bench); ) {
+        init_array(array, len, 0xA77);
+        bench_tic(bench);
+        merge_sort(array, len, MERGE_SORT_THRESHHOLD);
+        bench_toc(bench);
+    }
+    const double sort_ops = (double)len * levels, sort_bytes = 16.0 * len * (levels + 1);
+    print_kernel(roof, "merge_sort", sort_ops, sort_bytes, bench_report(bench, sort_ops, len, sort_bytes));
+
+    // The reduction of offload-avg.c, run on the host
+    long sum = 0;
+    for (bench_start(bench, "avg %zu", len); bench_running(bench); ) {
+        bench_tic(bench);
+        sum = 0;
+        #pragma omp parallel for reduction(+: sum)
+            for (size_t i = 0; i < len; ++i) {
+                sum += array[i];
+            }
+        bench_toc(bench);
+    }
+    print_kernel(roof, "avg", len, 8.0 * len, bench_report(bench, len, len, 8.0 * len));
+    if (sum < 0) {
+        printf("Negative sum!\n");
+    }
+
+    delete_array(array, len);
+    delete_array(sorted, len);
+}
+
+void print_usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [options]\n", prog);
+    fprintf(stderr, "  -s, --stream-len N    elements of each STREAM array, should be well beyond the LLC (default: %d)\n", ROOFLINE_STREAM_LEN);
+    fprintf(stderr, "  -n, --dim N           matrix size of the block kernel (default: %d)\n", ROOFLINE_MATRIX_DIM);
+    fprintf(stderr, "  -l, --len N           array length of the merge, sort and avg kernels (default: %d)\n", ROOFLINE_SORT_LEN);
+    fprintf(stderr, "  -i, --iters N         iterations of the peak compute probes (default: %d)\n", ROOFLINE_PEAK_ITERS);
+    fprintf(stderr, "  -t, --threads N       largest thread count, the kernels run with it (default: all)\n");
+    fprintf(stderr, "  -h, --help            show this message\n");
+}
+
+int main(int argc, char** argv)
+{
+    size_t stream_len = ROOFLINE_STREAM_LEN, dim = ROOFLINE_MATRIX_DIM, len = ROOFLINE_SORT_LEN;
+    size_t iters = ROOFLINE_PEAK_ITERS;
+    int max_threads = omp_get_max_threads();
+
+    static struct option long_options[] = {
+        {"stream-len", required_argument, NULL, 's'},
+        {"dim", required_argument, NULL, 'n'},
+        {"len", required_argument, NULL, 'l'},
+        {"iters", required_argument, NULL, 'i'},
+        {"threads", required_argument, NULL, 't'},
+        {"help", no_argument, NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "s:n:l:i:t:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 's':
+                stream_len = strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                dim = strtoul(optarg, NULL, 10);
+                break;
+            case 'l':
+                len = strtoul(optarg, NULL, 10);
+                break;
+            case 'i':
+                iters = strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                max_threads = atoi(optarg);
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (!stream_len || !dim || len < 2 || max_threads < 1) {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    omp_set_num_threads(max_threads);
+    enable_omp_parallel = 1;
+
+    bench_t bench;
+    bench_init(&bench, "roofline");
+    printf("Roofline of %s, %d threads, SIMD instruction set: %s\n", bench_get(&bench, "cpu"), max_threads, simd_isa_name());
+    printf("Rates are the best of %d repetitions for the probes and the median for the kernels\n", bench.reps);
+    print_memory_policy();
+
+    // STREAM arrays, first touched by the threads that use them with the static schedule
+    double* a = (double*)create_buffer(sizeof(double)*stream_len);
+    double* b = (double*)create_buffer(sizeof(double)*stream_len);
+    double* c = (double*)create_buffer(sizeof(double)*stream_len);
+    if (!a || !b || !c) {
+        exit(EXIT_FAILURE);
+    }
+    #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < stream_len; ++i) {
+            a[i] = 1.0;
+            b[i] = 2.0;
+            c[i] = 0.0;
+        }
+
+    roofline_t roof = {0, 0, 0};
+    printf("\n");
+    printf("%-8s %10s %10s %10s %10s %12s %12s\n", "threads", "copy", "scale", "add", "triad", "i64 GOP/s", "f64 GFLOP/s");
+    for (int threads = 1; threads <= max_threads; threads = (threads*2 > max_threads && threads < max_threads) ? max_threads : threads*2) {
+        bench_set(&bench, "threads", "%d", threads);
+        printf("%-8d", threads);
+        for (int k = 0; k < STREAM_NUM_KERNELS; ++k) {
+            double bw = measure_stream(&bench, k, a, b, c, stream_len, threads);
+            printf(" %10.2lf", bw);
+            if (threads == max_threads && bw > roof.bandwidth) {
+                roof.bandwidth = bw;
+            }
+        }
+
+        double peak_int = measure_peak(&bench, 0, iters, threads);
+        double peak_float = measure_peak(&bench, 1, iters, threads);
+        printf(" %12.2lf %12.2lf\n", peak_int, peak_float);
+        if (threads == max_threads) {
+            roof.peak_int = peak_int;
+            roof.peak_float = peak_float;
+        }
+    }
+    bench_set(&bench, "threads", "%d", max_threads);
+    printf("(STREAM columns in GB/s)\n");
+
+    delete_buffer(a, sizeof(double)*stream_len);
+    delete_buffer(b, sizeof(double)*stream_len);
+    delete_buffer(c, sizeof(double)*stream_len);
+
+    printf("\n");
+    printf("Bandwidth roof: %.2lf GB/s, compute roofs: %.2lf GOP/s int64, %.2lf GFLOP/s f64\n",
+           roof.bandwidth, roof.peak_int, roof.peak_float);
+    printf("Ridge point: %.2lf op/B int64, %.2lf flop/B f64\n",
+           roof.peak_int / roof.bandwidth, roof.peak_float / roof.bandwidth);
+
+    roofline_kernels(&bench, &roof, dim, len);
+
+    return 0;
+}
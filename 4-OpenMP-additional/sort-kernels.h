@@ -0,0 +1,192 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+/*
+    Parallel merge sort of long arrays: recursion down to insertion-sorted
+    leaves of at most threshold elements, with halves of more than
+    sort_task_min elements sorted as separate tasks. sort.c benchmarks and
+    tunes it, roofline.c measures its memory traffic.
+
+    The leaf sort and the merge of two runs come in a sort_ops_t, so
+    sort-simd.h runs the same recursion with sorting networks and vector
+    merges; merge_sort() uses the scalar ones.
+
+    The array and one temporary buffer take turns as source and destination:
+    every level merges from one into the other, so a level reads and writes
+    each element once and nothing is copied back. Leaves are sorted in the
+    buffer their parent merges from.
+
+    Merges of at least sort_parallel_merge_min elements are split with
+    merge-path co-ranks into one equal slice per thread, so the top levels,
+    where few merges are left, still use the whole team.
+*/
+
+#ifndef SORT_PARALLEL_MERGE_MIN
+    #define SORT_PARALLEL_MERGE_MIN (1 << 16)
+#endif
+#ifndef SORT_TASK_MIN
+    #define SORT_TASK_MIN (1 << 14)
+#endif
+
+enum {
+        MERGE_SORT_THRESHHOLD = 64,
+        // Smallest slice a parallel merge hands to one task
+        SORT_MERGE_SLICE_MIN = 1 << 13
+    };
+
+// Compile-time defaults, can be overridden by the tune cache and then from the command line.
+// SIZE_MAX keeps every merge sequential.
+size_t sort_parallel_merge_min = SORT_PARALLEL_MERGE_MIN;
+size_t sort_task_min = SORT_TASK_MIN;
+
+typedef void (*leaf_sort_t)(long* array, size_t n);
+typedef void (*merge_runs_t)(const long* a, size_t m, const long* b, size_t n, long* out);
+
+typedef struct {
+    leaf_sort_t leaf;
+    merge_runs_t merge;
+} sort_ops_t;
+
+void _insertion_sort(long *array, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+
+        long key = array[i];
+        size_t j = i;
+        while (j > 0 && array[j - 1] > key) {
+            array[j] = array[j - 1];
+            j--;
+        }
+
+        array[j] = key;
+    }
+}
+
+// Merge-path co-rank: how many of the first k merged elements come from a (length m), the rest
+// come from b (length n). Ties go to a first, so splitting a merge keeps it stable.
+size_t _merge_co_rank(size_t k, const long* a, size_t m, const long* b, size_t n)
+{
+    size_t lo = k > n ? k - n : 0, hi = k < m ? k : m;
+
+    // Smallest i for which a[i] no longer precedes b[k - i - 1]
+    while (lo < hi) {
+        size_t i = lo + (hi - lo) / 2;
+        if (b[k - i - 1] >= a[i]) {
+            lo = i + 1;
+        } else {
+            hi = i;
+        }
+    }
+
+    return lo;
+}
+
+void _merge_runs(const long* a, size_t m, const long* b, size_t n, long* out)
+{
+    size_t i = 0, j = 0, k = 0;
+
+    while (i < m && j < n) {
+        if (a[i] <= b[j]) out[k++] = a[i++];
+        else out[k++] = b[j++];
+    }
+
+    while (i < m) out[k++] = a[i++];
+    while (j < n) out[k++] = b[j++];
+}
+
+// Merges the sorted runs src[left, mid) and src[mid, right) into dst[left, right)
+void _merge(const long* src, long* dst, size_t left, size_t mid, size_t right)
+{
+    _merge_runs(src + left, mid - left, src + mid, right - mid, dst + left);
+}
+
+const sort_ops_t scalar_sort_ops = {_insertion_sort, _merge_runs};
+
+// Same result as _merge(), with the output cut into equal slices merged by separate tasks
+void _parallel_merge(const long* src, long* dst, size_t left, size_t mid, size_t right, merge_runs_t merge)
+{
+    const size_t m = mid - left, n = right - mid, len = m + n;
+    const long* a = src + left;
+    const long* b = src + mid;
+
+    size_t slices = omp_get_num_threads();
+    if (slices > len / SORT_MERGE_SLICE_MIN) {
+        slices = len / SORT_MERGE_SLICE_MIN;
+    }
+    if (slices < 2) {
+        merge(a, m, b, n, dst + left);
+        return;
+    }
+
+    #pragma omp taskloop grainsize(1)
+        for (size_t s = 0; s < slices; ++s) {
+            const size_t k0 = len * s / slices, k1 = len * (s + 1) / slices;
+            const size_t i0 = _merge_co_rank(k0, a, m, b, n), i1 = _merge_co_rank(k1, a, m, b, n);
+
+            merge(a + i0, i1 - i0, b + (k0 - i0), (k1 - i1) - (k0 - i0), dst + left + k0);
+        }
+}
+
+// Sorts array[left, right), leaving the result in temp instead if to_temp is set.
+// Both buffers are overwritten in the range.
+void _parallel_merge_sort(long* array, long* temp, size_t left, size_t right, int to_temp, size_t threshold,
+                          const sort_ops_t* ops)
+{
+    const size_t len = right - left;
+
+    if (len <= threshold) {
+        long* dst = to_temp ? temp : array;
+        if (to_temp) {
+            memcpy(temp + left, array + left, len * sizeof(long));
+        }
+        ops->leaf(dst + left, len);
+        return;
+    }
+
+    // Halves end up in the other buffer, then merge into this one
+    const size_t mid = left + len / 2;
+    if (len > sort_task_min) {
+        #pragma omp task
+            _parallel_merge_sort(array, temp, left, mid, !to_temp, threshold, ops);
+        #pragma omp task
+            _parallel_merge_sort(array, temp, mid, right, !to_temp, threshold, ops);
+        #pragma omp taskwait
+    } else {
+        _parallel_merge_sort(array, temp, left, mid, !to_temp, threshold, ops);
+        _parallel_merge_sort(array, temp, mid, right, !to_temp, threshold, ops);
+    }
+
+    const long* src = to_temp ? array : temp;
+    long* dst = to_temp ? temp : array;
+    if (len >= sort_parallel_merge_min) {
+        _parallel_merge(src, dst, left, mid, right, ops->merge);
+    } else {
+        ops->merge(src + left, mid - left, src + mid, right - mid, dst + left);
+    }
+}
+
+void _merge_sort(long *array, size_t n, size_t threshold, const sort_ops_t* ops) {
+    if (n < 2) {
+        return;
+    }
+
+    long *temp = (long *)malloc(n * sizeof(long));
+    if (!temp) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    #pragma omp parallel
+    {
+        #pragma omp single
+            _parallel_merge_sort(array, temp, 0, n, 0, threshold, ops);
+    }
+    free(temp);
+}
+
+void merge_sort(long *array, size_t n, int threshold) {
+    _merge_sort(array, n, threshold, &scalar_sort_ops);
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "memory-tools.h"
+
+/*
+    Parallel non-comparison sorts of long keys. Keys are taken relative to
+    the smallest one as unsigned numbers, so negative keys work and a small
+    range needs few digits.
+
+    counting_sort_range() sorts keys from a known range of at most
+    sort_counting_max_range values in place: per-thread histograms, a
+    prefix sum, and every thread writing its equal share of the output.
+
+    radix_sort_range() is an LSD radix sort with sort_radix_bits-bit digits
+    (8, 11 or 16) and only as many passes as the range needs. Each pass
+    builds per-thread digit histograms of a static chunk, turns them into
+    per-thread offsets and scatters the chunk stably into the other of two
+    ping-pong buffers. The buffer is first touched with the same static
+    split, so under NUMA every thread reads its chunk from local memory.
+    Digits that are the same in all keys, found in one pass up front, are
+    skipped.
+
+    integer_sort() finds the range first and picks one of the two.
+*/
+
+#ifndef SORT_COUNTING_MAX_RANGE
+    #define SORT_COUNTING_MAX_RANGE (1 << 16)
+#endif
+#ifndef SORT_RADIX_BITS
+    #define SORT_RADIX_BITS 8
+#endif
+
+// Compile-time defaults, can be overridden from the command line
+size_t sort_counting_max_range = SORT_COUNTING_MAX_RANGE;
+int sort_radix_bits = SORT_RADIX_BITS;
+
+typedef struct {
+    long min;
+    long max;
+} key_range_t;
+
+key_range_t key_range(const long* array, size_t n)
+{
+    long min = n ? array[0] : 0, max = min;
+
+    #pragma omp parallel for schedule(static) reduction(min: min) reduction(max: max)
+        for (size_t i = 0; i < n; ++i) {
+            min = array[i] < min ? array[i] : min;
+            max = array[i] > max ? array[i] : max;
+        }
+
+    key_range_t range = {min, max};
+    return range;
+}
+
+// All keys must be in [min, max]
+void counting_sort_range(long* array, size_t n, long min, long max)
+{
+    const uint64_t base = (uint64_t)min;
+    const size_t range = (size_t)((uint64_t)max - base) + 1;
+    const int num_threads = omp_get_max_threads();
+
+    size_t* counts = (size_t*)calloc((size_t)num_threads * range, sizeof(size_t));
+    size_t* starts = (size_t*)malloc((range + 1) * sizeof(size_t));
+    if (!counts || !starts) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        const int nt = omp_get_num_threads();
+        size_t* count = counts + (size_t)omp_get_thread_num() * range;
+
+        #pragma omp for schedule(static)
+            for (size_t i = 0; i < n; ++i) {
+                count[(uint64_t)array[i] - base]++;
+            }
+
+        #pragma omp for schedule(static)
+            for (size_t v = 0; v < range; ++v) {
+                for (int t = 1; t < nt; ++t) {
+                    counts[v] += counts[(size_t)t * range + v];
+                }
+            }
+
+        #pragma omp single
+        {
+            starts[0] = 0;
+            for (size_t v = 0; v < range; ++v) {
+                starts[v + 1] = starts[v] + counts[v];
+            }
+        }
+
+        // Equal output slices, each starting at the value whose run contains its first position
+        #pragma omp for schedule(static)
+            for (int s = 0; s < nt; ++s) {
+                const size_t lo = n * s / nt, hi = n * (s + 1) / nt;
+
+                size_t first = 0, last = range;
+                while (last - first > 1) {
+                    size_t v = first + (last - first) / 2;
+                    if (starts[v] <= lo) {
+                        first = v;
+                    } else {
+                        last = v;
+                    }
+                }
+
+                for (size_t pos = lo, v = first; pos < hi; ++v) {
+                    const size_t end = starts[v + 1] < hi ? starts[v + 1] : hi;
+                    const long key = (long)(base + v);
+                    for (; pos < end; ++pos) {
+                        array[pos] = key;
+                    }
+                }
+            }
+    }
+
+    free(counts);
+    free(starts);
+}
+
+// All keys must be in [min, max], bits is the digit width
+void radix_sort_range(long* array, size_t n, long min, long max, int bits)
+{
+    const uint64_t base = (uint64_t)min, span = (uint64_t)max - base;
+    const int key_bits = span ? 64 - __builtin_clzll(span) : 0;
+    const int passes = (key_bits + bits - 1) / bits;
+    const size_t buckets = (size_t)1 << bits;
+    const uint64_t mask = buckets - 1;
+    const int num_threads = omp_get_max_threads();
+
+    if (!passes || n < 2) {
+        return;
+    }
+
+    long* buffer = (long*)create_buffer(n * sizeof(long));
+    size_t* offsets = (size_t*)malloc((size_t)num_threads * buckets * sizeof(size_t));
+    if (!buffer || !offsets) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    if (!(get_memory_policy() & MEMORY_TOUCH)) {
+        _touch_buffer((char*)buffer, n * sizeof(long));
+    }
+
+    // Bits in which some relative key differs from the first one
+    const uint64_t first = (uint64_t)array[0] - base;
+    uint64_t differ = 0;
+    #pragma omp parallel for schedule(static) reduction(|: differ)
+        for (size_t i = 0; i < n; ++i) {
+            differ |= ((uint64_t)array[i] - base) ^ first;
+        }
+
+    long* src = array;
+    long* dst = buffer;
+    for (int pass = 0; pass < passes; ++pass) {
+        const int shift = pass * bits;
+        if (!((differ >> shift) & mask)) {
+            continue;
+        }
+
+        #pragma omp parallel num_threads(num_threads)
+        {
+            const int t = omp_get_thread_num(), nt = omp_get_num_threads();
+            const size_t lo = n * t / nt, hi = n * (t + 1) / nt;
+            size_t* offset = offsets + (size_t)t * buckets;
+
+            memset(offset, 0, buckets * sizeof(size_t));
+            for (size_t i = lo; i < hi; ++i) {
+                offset[(((uint64_t)src[i] - base) >> shift) & mask]++;
+            }
+
+            #pragma omp barrier
+            // Exclusive prefix sum in (digit, thread) order keeps equal digits in input order
+            #pragma omp single
+            {
+                size_t sum = 0;
+                for (size_t d = 0; d < buckets; ++d) {
+                    for (int u = 0; u < nt; ++u) {
+                        const size_t count = offsets[(size_t)u * buckets + d];
+                        offsets[(size_t)u * buckets + d] = sum;
+                        sum += count;
+                    }
+                }
+            }
+
+            for (size_t i = lo; i < hi; ++i) {
+                dst[offset[(((uint64_t)src[i] - base) >> shift) & mask]++] = src[i];
+            }
+        }
+
+        long* swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != array) {
+        #pragma omp parallel for schedule(static)
+            for (size_t i = 0; i < n; ++i) {
+                array[i] = src[i];
+            }
+    }
+
+    free(offsets);
+    delete_buffer(buffer, n * sizeof(long));
+}
+
+void integer_sort(long* array, size_t n)
+{
+    const key_range_t range = key_range(array, n);
+
+    if ((uint64_t)range.max - (uint64_t)range.min < sort_counting_max_range) {
+        counting_sort_range(array, n, range.min, range.max);
+    } else {
+        radix_sort_range(array, n, range.min, range.max, sort_radix_bits);
+    }
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <omp.h>
+#include "memory-tools.h"
+#include "random-tools.h"
+#include "sort-kernels.h"
+
+/*
+    Parallel sample sort of long arrays. Instead of log2(n) merge levels
+    over the whole array, keys move twice: once into buckets, once back
+    through a bucket-local sort that runs in cache.
+
+    k - 1 splitters (k a power of two) are every SORT_SAMPLE_OVERSAMPLING-th
+    key of a sorted random sample of SORT_SAMPLE_OVERSAMPLING * k keys, and
+    are stored as an implicit binary search tree. A key is classified
+    without branches by log2(k) compare-and-descend steps, a few keys at a
+    time so their loads overlap, into bucket b with
+    splitter[b - 1] < key <= splitter[b]. Keys equal to splitter[b] go to an
+    equality bucket of their own, so heavily repeated keys neither overfill
+    a bucket nor need sorting.
+
+    Every thread classifies a static chunk, remembering the bucket of every
+    key, and counts its keys per bucket. Prefix sums in (bucket, thread)
+    order give each thread its offsets, the chunks are scattered into a
+    buffer, and the buckets are sorted back into the array by the merge sort
+    of sort-kernels.h with the leaf sort and merge of the given sort_ops_t,
+    one bucket at a time from a dynamic schedule.
+
+    k grows with n so buckets hold about sort_sample_bucket_len keys, with
+    at least SORT_SAMPLE_BUCKETS_PER_THREAD buckets per thread for balance.
+*/
+
+#ifndef SORT_SAMPLE_BUCKET_LEN
+    #define SORT_SAMPLE_BUCKET_LEN (1 << 14)
+#endif
+
+enum {
+        SORT_SAMPLE_OVERSAMPLING = 16,
+        SORT_SAMPLE_BUCKETS_PER_THREAD = 4,
+        // Bucket numbers, with the equality buckets, must fit in uint16_t
+        SORT_SAMPLE_MAX_BUCKETS = 1 << 12,
+        // Keys classified together
+        SORT_SAMPLE_UNROLL = 8,
+        SORT_SAMPLE_SEED = 0x5A3
+    };
+
+// Compile-time default, can be overridden from the command line
+size_t sort_sample_bucket_len = SORT_SAMPLE_BUCKET_LEN;
+
+// Fills the implicit tree (children of node i are 2i and 2i + 1) in order from splitters
+size_t _sample_build_tree(long* tree, const long* splitters, size_t node, size_t k, size_t next)
+{
+    if (node >= k) {
+        return next;
+    }
+
+    next = _sample_build_tree(tree, splitters, 2*node, k, next);
+    tree[node] = splitters[next++];
+
+    return _sample_build_tree(tree, splitters, 2*node + 1, k, next);
+}
+
+// Bucket numbers of keys[0, count): 2b for splitter[b - 1] < key < splitter[b], 2b + 1 for key == splitter[b]
+void _sample_classify(const long* keys, size_t count, uint16_t* buckets, const long* tree, const long* splitters,
+                      size_t k, int levels)
+{
+    size_t i = 0;
+
+    for (; i + SORT_SAMPLE_UNROLL <= count; i += SORT_SAMPLE_UNROLL) {
+        size_t node[SORT_SAMPLE_UNROLL];
+
+        for (int u = 0; u < SORT_SAMPLE_UNROLL; ++u) {
+            node[u] = 1;
+        }
+        for (int l = 0; l < levels; ++l) {
+            for (int u = 0; u < SORT_SAMPLE_UNROLL; ++u) {
+                node[u] = 2*node[u] + (keys[i + u] > tree[node[u]]);
+            }
+        }
+        for (int u = 0; u < SORT_SAMPLE_UNROLL; ++u) {
+            const size_t b = node[u] - k;
+            buckets[i + u] = (uint16_t)(2*b + (keys[i + u] == splitters[b]));
+        }
+    }
+
+    for (; i < count; ++i) {
+        size_t n = 1;
+        for (int l = 0; l < levels; ++l) {
+            n = 2*n + (keys[i] > tree[n]);
+        }
+        buckets[i] = (uint16_t)(2*(n - k) + (keys[i] == splitters[n - k]));
+    }
+}
+
+// Sorts array[0, n), leaves of the bucket sorts have at most threshold elements
+void _sample_sort(long* array, size_t n, size_t threshold, const sort_ops_t* ops)
+{
+    const int num_threads = omp_get_max_threads();
+
+    size_t k = 2;
+    while (k < SORT_SAMPLE_MAX_BUCKETS &&
+           (k * sort_sample_bucket_len < n || k < (size_t)num_threads * SORT_SAMPLE_BUCKETS_PER_THREAD)) {
+        k *= 2;
+    }
+    const size_t sample_len = SORT_SAMPLE_OVERSAMPLING * k;
+    const size_t num_buckets = 2 * k;
+    int levels = 0;
+    while (((size_t)1 << levels) < k) {
+        ++levels;
+    }
+
+    // Too small to be worth the classification
+    if (n < 2 * sample_len) {
+        _merge_sort(array, n, threshold, ops);
+        return;
+    }
+
+    long* sample = (long*)malloc(2 * sample_len * sizeof(long));
+    long* tree = (long*)malloc(k * sizeof(long));
+    long* splitters = (long*)malloc(k * sizeof(long));
+    size_t* offsets = (size_t*)malloc((size_t)num_threads * num_buckets * sizeof(size_t));
+    size_t* starts = (size_t*)malloc((num_buckets + 1) * sizeof(size_t));
+    uint16_t* oracle = (uint16_t*)malloc(n * sizeof(uint16_t));
+    long* buffer = (long*)create_buffer(n * sizeof(long));
+    if (!sample || !tree || !splitters || !offsets || !starts || !oracle || !buffer) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    if (!(get_memory_policy() & MEMORY_TOUCH)) {
+        _touch_buffer((char*)buffer, n * sizeof(long));
+    }
+
+    for (size_t i = 0; i < sample_len; ++i) {
+        sample[i] = array[random_at(SORT_SAMPLE_SEED, i) % n];
+    }
+    _parallel_merge_sort(sample, sample + sample_len, 0, sample_len, 0, threshold, ops);
+
+    // The last splitter only backs the equality test of the top bucket
+    for (size_t b = 0; b + 1 < k; ++b) {
+        splitters[b] = sample[(b + 1) * SORT_SAMPLE_OVERSAMPLING - 1];
+    }
+    splitters[k - 1] = LONG_MAX;
+    _sample_build_tree(tree, splitters, 1, k, 0);
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        const int t = omp_get_thread_num(), nt = omp_get_num_threads();
+        const size_t lo = n * t / nt, hi = n * (t + 1) / nt;
+        size_t* offset = offsets + (size_t)t * num_buckets;
+
+        _sample_classify(array + lo, hi - lo, oracle + lo, tree, splitters, k, levels);
+
+        memset(offset, 0, num_buckets * sizeof(size_t));
+        for (size_t i = lo; i < hi; ++i) {
+            offset[oracle[i]]++;
+        }
+
+        #pragma omp barrier
+        // Exclusive prefix sum in (bucket, thread) order, buckets stay contiguous
+        #pragma omp single
+        {
+            size_t sum = 0;
+            for (size_t b = 0; b < num_buckets; ++b) {
+                starts[b] = sum;
+                for (int u = 0; u < nt; ++u) {
+                    const size_t count = offsets[(size_t)u * num_buckets + b];
+                    offsets[(size_t)u * num_buckets + b] = sum;
+                    sum += count;
+                }
+            }
+            starts[num_buckets] = sum;
+        }
+
+        for (size_t i = lo; i < hi; ++i) {
+            buffer[offset[oracle[i]]++] = array[i];
+        }
+
+        #pragma omp barrier
+        // Equality buckets only move back, the others are sorted from the buffer into the array
+        #pragma omp for schedule(dynamic, 1)
+            for (size_t b = 0; b < num_buckets; ++b) {
+                const size_t first = starts[b], last = starts[b + 1];
+                if (b & 1) {
+                    memcpy(array + first, buffer + first, (last - first) * sizeof(long));
+                } else {
+                    _parallel_merge_sort(buffer, array, first, last, 1, threshold, ops);
+                }
+            }
+    }
+
+    free(sample);
+    free(tree);
+    free(splitters);
+    free(offsets);
+    free(starts);
+    free(oracle);
+    delete_buffer(buffer, n * sizeof(long));
+}
+
+void sample_sort(long* array, size_t n, int threshold)
+{
+    _sample_sort(array, n, threshold, &scalar_sort_ops);
+}
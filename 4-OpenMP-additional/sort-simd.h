@@ -0,0 +1,338 @@
+#pragma once
+
+#include <limits.h>
+#include <string.h>
+#include <immintrin.h>
+#include "sort-kernels.h"
+
+/*
+    SIMD base case for the merge sort of sort-kernels.h. A leaf is loaded
+    into registers, padded with LONG_MAX, and each vector is sorted by an
+    in-register bitonic network of lane permutes and min/max. Sorted vectors
+    are then merged pairwise by bitonic merge networks until the registers
+    hold one sorted run: 16 vectors of 8 longs with AVX-512, 8 vectors of 4
+    with AVX2, which has no 64-bit min/max and compares and blends instead.
+
+    Merges of two runs go through the same network: two vectors are merged,
+    the lower one is stored, and the next vector comes from the run whose
+    next element is smaller. Runs are padded with LONG_MAX to whole vectors
+    and only the real elements are stored, so there is no scalar tail.
+
+    simd_merge_sort() picks the widest instruction set of the CPU at run
+    time and sorts leaves of one block, larger than insertion sort can
+    afford; without AVX2 it is merge_sort().
+    The networks are not stable, which does not matter for plain keys.
+*/
+
+enum {
+        SORT_AVX512_LANES = 8,
+        SORT_AVX512_BLOCK = 16 * SORT_AVX512_LANES,
+        SORT_AVX2_LANES = 4,
+        SORT_AVX2_BLOCK = 8 * SORT_AVX2_LANES
+    };
+
+// Picks the widest instruction set of the CPU the sorting networks can use
+const char* sort_isa_name()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return "avx512";
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return "avx2";
+    }
+
+    return "scalar";
+}
+
+// AVX-512: lanes exchange with lane ^ 4, ^ 2 or ^ 1, lanes set in max_lanes keep the larger key
+__attribute__((target("avx512f")))
+static inline __m512i __avx512_exchange(__m512i v, __m512i partner, __mmask8 max_lanes)
+{
+    return _mm512_mask_blend_epi64(max_lanes, _mm512_min_epi64(v, partner), _mm512_max_epi64(v, partner));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i __avx512_xor4(__m512i v)
+{
+    return _mm512_shuffle_i64x2(v, v, 0x4E);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i __avx512_xor2(__m512i v)
+{
+    return _mm512_permutex_epi64(v, 0x4E);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i __avx512_xor1(__m512i v)
+{
+    return _mm512_shuffle_epi32(v, (_MM_PERM_ENUM)0x4E);
+}
+
+// Sorts a bitonic vector
+__attribute__((target("avx512f")))
+static inline __m512i __avx512_bitonic_clean(__m512i v)
+{
+    v = __avx512_exchange(v, __avx512_xor4(v), 0xF0);
+    v = __avx512_exchange(v, __avx512_xor2(v), 0xCC);
+
+    return __avx512_exchange(v, __avx512_xor1(v), 0xAA);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i __avx512_sort_vector(__m512i v)
+{
+    v = __avx512_exchange(v, __avx512_xor1(v), 0x66);
+    v = __avx512_exchange(v, __avx512_xor2(v), 0x3C);
+    v = __avx512_exchange(v, __avx512_xor1(v), 0x5A);
+
+    return __avx512_bitonic_clean(v);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i __avx512_reverse(__m512i v)
+{
+    return _mm512_permutexvar_epi64(_mm512_set_epi64(0, 1, 2, 3, 4, 5, 6, 7), v);
+}
+
+// v[0, n) and v[n, 2n) are ascending runs, afterwards v[0, 2n) is one
+__attribute__((target("avx512f")))
+static inline void __avx512_merge_vectors(__m512i* v, int n)
+{
+    // Reversing the second run makes the whole sequence bitonic
+    for (int i = 0; i < n; ++i) {
+        v[2*n - 1 - i] = __avx512_reverse(v[2*n - 1 - i]);
+    }
+    for (int i = 0; i < n / 2; ++i) {
+        __m512i swap = v[n + i];
+        v[n + i] = v[2*n - 1 - i];
+        v[2*n - 1 - i] = swap;
+    }
+    // Half-cleaners leave two bitonic halves, every key of the lower one not above the upper one
+    for (int half = n; half > 0; half /= 2) {
+        for (int i = 0; i < 2*n; ++i) {
+            if (!(i & half)) {
+                __m512i lo = v[i], hi = v[i + half];
+                v[i] = _mm512_min_epi64(lo, hi);
+                v[i + half] = _mm512_max_epi64(lo, hi);
+            }
+        }
+    }
+    for (int i = 0; i < 2*n; ++i) {
+        v[i] = __avx512_bitonic_clean(v[i]);
+    }
+}
+
+// Eight keys of run from i on, LONG_MAX past len
+__attribute__((target("avx512f")))
+static inline __m512i __avx512_load_run(const long* run, size_t i, size_t len)
+{
+    const size_t count = i < len ? (len - i < SORT_AVX512_LANES ? len - i : SORT_AVX512_LANES) : 0;
+
+    return _mm512_mask_loadu_epi64(_mm512_set1_epi64(LONG_MAX), (__mmask8)((1u << count) - 1), run + i);
+}
+
+__attribute__((target("avx512f")))
+static inline void __avx512_store_run(long* run, size_t i, size_t len, __m512i v)
+{
+    const size_t count = i < len ? (len - i < SORT_AVX512_LANES ? len - i : SORT_AVX512_LANES) : 0;
+
+    _mm512_mask_storeu_epi64(run + i, (__mmask8)((1u << count) - 1), v);
+}
+
+// Sorts at most SORT_AVX512_BLOCK keys in registers
+__attribute__((target("avx512f")))
+void _avx512_sort_block(long* array, size_t n)
+{
+    const int vectors = SORT_AVX512_BLOCK / SORT_AVX512_LANES;
+    __m512i v[SORT_AVX512_BLOCK / SORT_AVX512_LANES];
+
+    for (int r = 0; r < vectors; ++r) {
+        v[r] = __avx512_sort_vector(__avx512_load_run(array, (size_t)r * SORT_AVX512_LANES, n));
+    }
+    for (int width = 1; width < vectors; width *= 2) {
+        for (int r = 0; r < vectors; r += 2 * width) {
+            __avx512_merge_vectors(v + r, width);
+        }
+    }
+    for (int r = 0; r < vectors; ++r) {
+        __avx512_store_run(array, (size_t)r * SORT_AVX512_LANES, n, v[r]);
+    }
+}
+
+__attribute__((target("avx512f")))
+void _avx512_merge_runs(const long* a, size_t m, const long* b, size_t n, long* out)
+{
+    const size_t len = m + n;
+    __m512i v[2] = {__avx512_load_run(a, 0, m), __avx512_load_run(b, 0, n)};
+    size_t i = SORT_AVX512_LANES, j = SORT_AVX512_LANES;
+
+    // v[1] keeps the larger half, which is all padding once the last real key is stored
+    for (size_t k = 0; k < len; k += SORT_AVX512_LANES) {
+        __avx512_merge_vectors(v, 1);
+        __avx512_store_run(out, k, len, v[0]);
+
+        const long x = i < m ? a[i] : LONG_MAX, y = j < n ? b[j] : LONG_MAX;
+        if (x <= y) {
+            v[0] = __avx512_load_run(a, i, m);
+            i += SORT_AVX512_LANES;
+        } else {
+            v[0] = __avx512_load_run(b, j, n);
+            j += SORT_AVX512_LANES;
+        }
+    }
+}
+
+// AVX2 has no 64-bit min/max: compare and blend
+__attribute__((target("avx2")))
+static inline void __avx2_min_max(__m256i* lo, __m256i* hi)
+{
+    const __m256i greater = _mm256_cmpgt_epi64(*lo, *hi);
+    const __m256i min = _mm256_blendv_epi8(*lo, *hi, greater);
+
+    *hi = _mm256_blendv_epi8(*hi, *lo, greater);
+    *lo = min;
+}
+
+// Lanes exchange with lane ^ 2 or ^ 1, the blend immediate picks the 32-bit halves of the lanes
+// that keep the larger key
+#define __AVX2_EXCHANGE(v, partner, max_halves) do {                        \
+        __m256i _min = (v), _max = (partner);                               \
+        __avx2_min_max(&_min, &_max);                                       \
+        (v) = _mm256_blend_epi32(_min, _max, (max_halves));                 \
+    } while (0)
+
+__attribute__((target("avx2")))
+static inline __m256i __avx2_bitonic_clean(__m256i v)
+{
+    __AVX2_EXCHANGE(v, _mm256_permute4x64_epi64(v, 0x4E), 0xF0);
+    __AVX2_EXCHANGE(v, _mm256_shuffle_epi32(v, 0x4E), 0xCC);
+
+    return v;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i __avx2_sort_vector(__m256i v)
+{
+    __AVX2_EXCHANGE(v, _mm256_shuffle_epi32(v, 0x4E), 0x3C);
+
+    return __avx2_bitonic_clean(v);
+}
+
+__attribute__((target("avx2")))
+static inline void __avx2_merge_vectors(__m256i* v, int n)
+{
+    for (int i = 0; i < n; ++i) {
+        v[2*n - 1 - i] = _mm256_permute4x64_epi64(v[2*n - 1 - i], 0x1B);
+    }
+    for (int i = 0; i < n / 2; ++i) {
+        __m256i swap = v[n + i];
+        v[n + i] = v[2*n - 1 - i];
+        v[2*n - 1 - i] = swap;
+    }
+    for (int half = n; half > 0; half /= 2) {
+        for (int i = 0; i < 2*n; ++i) {
+            if (!(i & half)) {
+                __avx2_min_max(&v[i], &v[i + half]);
+            }
+        }
+    }
+    for (int i = 0; i < 2*n; ++i) {
+        v[i] = __avx2_bitonic_clean(v[i]);
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m256i __avx2_lane_mask(size_t i, size_t len)
+{
+    const long count = i < len ? (long)(len - i) : 0;
+
+    return _mm256_cmpgt_epi64(_mm256_set1_epi64x(count), _mm256_set_epi64x(3, 2, 1, 0));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i __avx2_load_run(const long* run, size_t i, size_t len)
+{
+    const __m256i mask = __avx2_lane_mask(i, len);
+
+    return _mm256_blendv_epi8(_mm256_set1_epi64x(LONG_MAX), _mm256_maskload_epi64((const long long*)run + i, mask), mask);
+}
+
+__attribute__((target("avx2")))
+static inline void __avx2_store_run(long* run, size_t i, size_t len, __m256i v)
+{
+    _mm256_maskstore_epi64((long long*)run + i, __avx2_lane_mask(i, len), v);
+}
+
+__attribute__((target("avx2")))
+void _avx2_sort_block(long* array, size_t n)
+{
+    const int vectors = SORT_AVX2_BLOCK / SORT_AVX2_LANES;
+    __m256i v[SORT_AVX2_BLOCK / SORT_AVX2_LANES];
+
+    for (int r = 0; r < vectors; ++r) {
+        v[r] = __avx2_sort_vector(__avx2_load_run(array, (size_t)r * SORT_AVX2_LANES, n));
+    }
+    for (int width = 1; width < vectors; width *= 2) {
+        for (int r = 0; r < vectors; r += 2 * width) {
+            __avx2_merge_vectors(v + r, width);
+        }
+    }
+    for (int r = 0; r < vectors; ++r) {
+        __avx2_store_run(array, (size_t)r * SORT_AVX2_LANES, n, v[r]);
+    }
+}
+
+__attribute__((target("avx2")))
+void _avx2_merge_runs(const long* a, size_t m, const long* b, size_t n, long* out)
+{
+    const size_t len = m + n;
+    __m256i v[2] = {__avx2_load_run(a, 0, m), __avx2_load_run(b, 0, n)};
+    size_t i = SORT_AVX2_LANES, j = SORT_AVX2_LANES;
+
+    for (size_t k = 0; k < len; k += SORT_AVX2_LANES) {
+        __avx2_merge_vectors(v, 1);
+        __avx2_store_run(out, k, len, v[0]);
+
+        const long x = i < m ? a[i] : LONG_MAX, y = j < n ? b[j] : LONG_MAX;
+        if (x <= y) {
+            v[0] = __avx2_load_run(a, i, m);
+            i += SORT_AVX2_LANES;
+        } else {
+            v[0] = __avx2_load_run(b, j, n);
+            j += SORT_AVX2_LANES;
+        }
+    }
+}
+
+const sort_ops_t avx512_sort_ops = {_avx512_sort_block, _avx512_merge_runs};
+const sort_ops_t avx2_sort_ops = {_avx2_sort_block, _avx2_merge_runs};
+
+// Leaf sort and merge of the widest instruction set, with threshold set to its block size.
+// Without AVX2 the scalar ones, threshold is left alone.
+const sort_ops_t* _select_sort_ops(size_t* threshold)
+{
+    const char* isa = sort_isa_name();
+
+    if (!strcmp(isa, "avx512")) {
+        *threshold = SORT_AVX512_BLOCK;
+        return &avx512_sort_ops;
+    }
+    if (!strcmp(isa, "avx2")) {
+        *threshold = SORT_AVX2_BLOCK;
+        return &avx2_sort_ops;
+    }
+
+    return &scalar_sort_ops;
+}
+
+// Sorts like merge_sort(), with leaves of one block of the widest instruction set.
+// threshold is only used by the scalar fallback.
+void simd_merge_sort(long* array, size_t n, int threshold)
+{
+    size_t leaf = threshold;
+    const sort_ops_t* ops = _select_sort_ops(&leaf);
+
+    _merge_sort(array, n, leaf, ops);
+}
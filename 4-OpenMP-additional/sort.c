@@ -1,124 +1,492 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
+#include <stdint.h>
+#include <limits.h>
+#include <getopt.h>
 #include <omp.h>
+#include "array-tools.h"
+#include "sort-kernels.h"
+#include "sort-simd.h"
+#include "sort-radix.h"
+#include "sort-sample.h"
+#include "tune-tools.h"
+#include "perf-tools.h"
+#include "bench-tools.h"
 
 #ifndef ARR_LEN
     #define ARR_LEN 1 << 28
 #endif
 
+#define SORT_DEFAULT_KERNEL "merge-path"
+
 enum {
-        ARR_ELEM_MAX = 100,
-        MERGE_SORT_THRESHHOLD = 64
+        MAX_SORT_KERNELS = 16,
+        SORT_TUNE_LEN = 1 << 22,
+        SORT_TUNE_REPS = 2,
+        SORT_INPUT_SEED = 0xA77
     };
 
-long* create_array(size_t len)
-{
-    const int prot_flags = PROT_READ|PROT_WRITE;
-    const int map_flags = MAP_PRIVATE|MAP_ANON;
-    void* ptr = mmap(NULL, sizeof(long)*len, prot_flags, map_flags, -1, 0);
-    if(ptr == MAP_FAILED) {
-        perror("mmap");
-        return NULL;
-    }
+// Input distributions, all over the keys [0, sort_input_keys)
+enum {
+        SORT_UNIFORM = 0,
+        SORT_SKEWED,
+        SORT_SORTED,
+        SORT_NUM_DISTS
+    };
 
-    return (long*)ptr;
-}
+const char* sort_dist_names[SORT_NUM_DISTS] = {"uniform", "skewed", "sorted"};
+
+// Set from the command line
+int sort_input_dist = SORT_UNIFORM;
+long sort_input_keys = ARR_ELEM_MAX;
+
+// Keys counting sort is told to expect, [0, sort_input_keys) or the range of a FILE dataset
+key_range_t sort_counting_range = {0, ARR_ELEM_MAX - 1};
 
-void delete_array(long* arr, size_t len)
+// uniform is init_array() for the default keys. skewed is keys * u^3 for uniform u in [0, 1), so a
+// fifth of the keys are below keys / 100. sorted is ascending with the keys spread evenly.
+void init_sort_input(long* array, size_t len)
 {
-    munmap(arr, sizeof(long)*len);
+    const long keys = sort_input_keys;
+
+    if (sort_input_dist == SORT_UNIFORM) {
+        fill_random(array, len, SORT_INPUT_SEED, keys);
+    } else if (sort_input_dist == SORT_SKEWED) {
+        #pragma omp parallel for schedule(static)
+            for (size_t i = 0; i < len; ++i) {
+                const double u = (random_at(SORT_INPUT_SEED, i) >> 11) * 0x1.0p-53;
+                array[i] = (long)(keys * u * u * u);
+            }
+    } else {
+        #pragma omp parallel for schedule(static)
+            for (size_t i = 0; i < len; ++i) {
+                array[i] = (long)((double)keys * i / len);
+            }
+    }
 }
 
-void init_array(long* arr, size_t len, unsigned int seed)
+// Best of SORT_TUNE_REPS sorts of the same SORT_TUNE_LEN random elements
+double _time_sort(long* array, int threshold)
 {
-    srand(seed);
+    double best = 1e30;
+
+    for (int rep = 0; rep < SORT_TUNE_REPS; ++rep) {
+        init_array(array, SORT_TUNE_LEN, 0xA77);
 
-    for (size_t i = 0; i < len; ++i) {
-        arr[i] = rand() % ARR_ELEM_MAX;
+        double start = omp_get_wtime();
+        merge_sort(array, SORT_TUNE_LEN, threshold);
+        double t = omp_get_wtime() - start;
+        best = t < best ? t : best;
     }
+
+    return best;
 }
 
-void _insertion_sort(long *array, size_t n) {
-    for (size_t i = 1; i < n; i++) {
+// Searches thread count, the insertion sort threshold, then the task cutoff, and stores the winners in the tune cache
+void tune_sort()
+{
+    long* array = create_array(SORT_TUNE_LEN);
+    if (!array) {
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Tuning for %s at length %d\n\n", tune_host(), SORT_TUNE_LEN);
+    printf("%-26s %10s %12s\n", "parameter", "value", "time");
+
+    const int num_procs = omp_get_num_procs();
+    int best_threads = 1;
+    double best = 1e30;
+    for (int threads = 1; threads <= num_procs; threads = (threads*2 > num_procs && threads < num_procs) ? num_procs : threads*2) {
+        omp_set_num_threads(threads);
+
+        double t = _time_sort(array, MERGE_SORT_THRESHHOLD);
+        printf("%-26s %10d %12lf\n", "sort_threads", threads, t);
+        if (t < best) {
+            best = t;
+            best_threads = threads;
+        }
+    }
+    omp_set_num_threads(best_threads);
+    tune_set("sort_threads", best_threads);
 
-        long key = array[i];
-        size_t j = i;
-        while (j > 0 && array[j - 1] > key) {
-            array[j] = array[j - 1];
-            j--;
+    int best_threshold = MERGE_SORT_THRESHHOLD;
+    best = 1e30;
+    for (int threshold = 8; threshold <= 4096; threshold *= 2) {
+        double t = _time_sort(array, threshold);
+        printf("%-26s %10d %12lf\n", "sort_threshhold", threshold, t);
+        if (t < best) {
+            best = t;
+            best_threshold = threshold;
         }
+    }
+    tune_set("sort_threshhold", best_threshold);
 
-        array[j] = key;
+    size_t best_task_min = SORT_TASK_MIN;
+    best = 1e30;
+    for (size_t task_min = 1 << 10; task_min <= 1 << 20; task_min *= 4) {
+        sort_task_min = task_min;
+        double t = _time_sort(array, best_threshold);
+        printf("%-26s %10zu %12lf\n", "sort_task_min", task_min, t);
+        if (t < best) {
+            best = t;
+            best_task_min = task_min;
+        }
     }
+    sort_task_min = best_task_min;
+    tune_set("sort_task_min", best_task_min);
+
+    printf("\nSaved to %s\n", tune_cache.path);
+    delete_array(array, SORT_TUNE_LEN);
 }
 
-void _merge(long *array, long *temp, int left, int mid, int right) {
-    int i = left, j = mid, k = left;
+// merge_sort() with every merge sequential, the behaviour before merge-path splitting
+void serial_merge_sort(long* array, size_t n, int threshold)
+{
+    const size_t merge_min = sort_parallel_merge_min;
 
-    while (i < mid && j < right) {
-        if (array[i] <= array[j]) temp[k++] = array[i++];
-        else temp[k++] = array[j++];
-    }
+    sort_parallel_merge_min = SIZE_MAX;
+    merge_sort(array, n, threshold);
+    sort_parallel_merge_min = merge_min;
+}
 
-    while (i < mid) temp[k++] = array[i++];
-    while (j < right) temp[k++] = array[j++];
+// Counting sort told the key range of the input, sort_counting_range
+void bounded_counting_sort(long* array, size_t n, int threshold)
+{
+    (void)threshold;
+    counting_sort_range(array, n, sort_counting_range.min, sort_counting_range.max);
+}
 
-    for (i = left; i < right; i++) array[i] = temp[i];
+// Radix sort over all 64 bits, only passes with a constant digit are skipped
+void full_radix_sort(long* array, size_t n, int threshold)
+{
+    (void)threshold;
+    radix_sort_range(array, n, LONG_MIN, LONG_MAX, sort_radix_bits);
 }
 
-void _parallel_merge_sort(long *array, long *temp, int left, int right, int threshold) {
-    if (right - left <= threshold) {
-        _insertion_sort(array + left, right - left);
-    } else {
-        int mid = left + (right - left)/2;
+void detect_integer_sort(long* array, size_t n, int threshold)
+{
+    (void)threshold;
+    integer_sort(array, n);
+}
 
-        #pragma omp task shared(array, temp) if(right - left > threshold)
-            _parallel_merge_sort(array, temp, left, mid, threshold);
-        #pragma omp task shared(array, temp) if(right - left > threshold)
-            _parallel_merge_sort(array, temp, mid, right, threshold);
+// sample_sort() with the bucket sorts of simd_merge_sort()
+void simd_sample_sort(long* array, size_t n, int threshold)
+{
+    size_t leaf = threshold;
+    const sort_ops_t* ops = _select_sort_ops(&leaf);
 
-        #pragma omp taskwait
-        _merge(array, temp, left, mid, right);
-    }
+    _sample_sort(array, n, leaf, ops);
 }
 
-void merge_sort(long *array, size_t n, int threshold) {
-    long *temp = (long *)malloc(n * sizeof(long));
-    #pragma omp parallel
-    {
-        #pragma omp single
-            _parallel_merge_sort(array, temp, 0, n, threshold);
+typedef struct {
+    const char* name;
+    void (*sort)(long* array, size_t n, int threshold);
+} sort_kernel_t;
+
+const sort_kernel_t sort_kernels[] = {
+    {"merge", serial_merge_sort},
+    {"merge-path", merge_sort},
+    {"merge-simd", simd_merge_sort},
+    {"counting", bounded_counting_sort},
+    {"radix", full_radix_sort},
+    {"integer", detect_integer_sort},
+    {"sample", sample_sort},
+    {"sample-simd", simd_sample_sort},
+};
+const size_t num_sort_kernels = sizeof(sort_kernels) / sizeof(sort_kernels[0]);
+
+const sort_kernel_t* find_sort_kernel(const char* name)
+{
+    for (size_t i = 0; i < num_sort_kernels; ++i) {
+        if (!strcmp(sort_kernels[i].name, name)) {
+            return &sort_kernels[i];
+        }
     }
-    free(temp);
+
+    return NULL;
 }
 
-int is_sorted(long *array, size_t n) {
-    for (size_t i = 1; i < n; i++) {
-        if (array[i - 1] > array[i]) return 0;
+// Sorts the same input with kernel at the current thread count, returns the median time.
+// The input is copied from input, or generated if that is NULL. sorted is set if the
+// result is in order and holds the same keys as the input.
+double bench_sort(bench_t* bench, const sort_kernel_t* kernel, long* array, const long* input, size_t len, int threshold,
+                  int* sorted)
+{
+    char label[96] = "";
+    perf_region_t perf;
+    array_digest_t before = {0, 0};
+    int have_digest = 0;
+
+    // Every repetition sorts the same unsorted input, restored outside the timer
+    snprintf(label, sizeof(label), "%s %zu %dt", kernel->name, len, omp_get_max_threads());
+    perf_region_begin(&perf, label);
+    perf_region_pause(&perf);
+    for (bench_start(bench, "%s", label); bench_running(bench); ) {
+        if (input) {
+            #pragma omp parallel for schedule(static)
+                for (size_t i = 0; i < len; ++i) {
+                    array[i] = input[i];
+                }
+        } else {
+            init_sort_input(array, len);
+        }
+        if (!have_digest) {
+            before = array_digest(array, len);
+            have_digest = 1;
+        }
+        if (bench_timed(bench)) {
+            perf_region_resume(&perf);
+        }
+        bench_tic(bench);
+        kernel->sort(array, len, threshold);
+        bench_toc(bench);
+        perf_region_pause(&perf);
     }
-    return 1;
+    perf_region_end(&perf);
+
+    const array_digest_t after = array_digest(array, len);
+    *sorted = is_sorted(array, len) && after.sum == before.sum && after.xor == before.xor;
+
+    return bench_report(bench, 0, len, 2.0 * sizeof(long) * len);
 }
 
-int main()
+void print_usage(const char* prog)
 {
-    printf("Array size: %d\n", ARR_LEN);
+    fprintf(stderr, "Usage: %s [options] [FILE]\n", prog);
+    fprintf(stderr, "  -k, --kernel LIST      comma-separated kernels or \"all\" (default: %s)\n", SORT_DEFAULT_KERNEL);
+    fprintf(stderr, "  -n, --len N            array length (default: %d)\n", ARR_LEN);
+    fprintf(stderr, "  -b, --threshold N      insertion sort threshold (default: %d)\n", MERGE_SORT_THRESHHOLD);
+    fprintf(stderr, "  -m, --merge-min N      merges of at least N elements are split between threads (default: %d)\n", SORT_PARALLEL_MERGE_MIN);
+    fprintf(stderr, "  -T, --task-min N       halves of more than N elements are sorted as separate tasks (default: %d)\n", SORT_TASK_MIN);
+    fprintf(stderr, "  -r, --radix-bits N     radix sort digit width, 8, 11 or 16 (default: %d)\n", SORT_RADIX_BITS);
+    fprintf(stderr, "  -c, --counting-max N   integer uses counting sort for key ranges up to N values (default: %d)\n", SORT_COUNTING_MAX_RANGE);
+    fprintf(stderr, "  -s, --bucket-len N     sample sort buckets hold about N elements (default: %d)\n", SORT_SAMPLE_BUCKET_LEN);
+    fprintf(stderr, "  -d, --dist NAME        input distribution: uniform, skewed or sorted (default: uniform)\n");
+    fprintf(stderr, "  -K, --keys N           input keys are drawn from [0, N) (default: %d)\n", ARR_ELEM_MAX);
+    fprintf(stderr, "  -t, --threads N        number of OpenMP threads\n");
+    fprintf(stderr, "  -S, --scaling          run every kernel with 1, 2, 4, ... up to the thread count\n");
+    fprintf(stderr, "  -u, --tune             tune parameters for this host and save them to the tune cache\n");
+    fprintf(stderr, "  -l, --list             list available kernels\n");
+    fprintf(stderr, "  -h, --help             show this message\n");
+    fprintf(stderr, "FILE is a dataset file to load the input from, created on first use.\n");
+}
 
-    long* array = create_array(ARR_LEN);
-    init_array(array, ARR_LEN, 0xA77);
+int main(int argc, char** argv)
+{
+    const sort_kernel_t* kernels[MAX_SORT_KERNELS] = {0};
+    int from_all[MAX_SORT_KERNELS] = {0};
+    size_t num_kernels = 0;
+    size_t len = ARR_LEN;
+    int scaling = 0;
 
-    double start = omp_get_wtime();
+    static struct option long_options[] = {
+        {"kernel", required_argument, NULL, 'k'},
+        {"len", required_argument, NULL, 'n'},
+        {"threshold", required_argument, NULL, 'b'},
+        {"merge-min", required_argument, NULL, 'm'},
+        {"task-min", required_argument, NULL, 'T'},
+        {"radix-bits", required_argument, NULL, 'r'},
+        {"counting-max", required_argument, NULL, 'c'},
+        {"bucket-len", required_argument, NULL, 's'},
+        {"dist", required_argument, NULL, 'd'},
+        {"keys", required_argument, NULL, 'K'},
+        {"threads", required_argument, NULL, 't'},
+        {"scaling", no_argument, NULL, 'S'},
+        {"tune", no_argument, NULL, 'u'},
+        {"list", no_argument, NULL, 'l'},
+        {"help", no_argument, NULL, 'h'},
+        {0, 0, 0, 0}
+    };
 
-    merge_sort(array, ARR_LEN, MERGE_SORT_THRESHHOLD);
+    int threshold = tune_get("sort_threshhold", MERGE_SORT_THRESHHOLD);
+    sort_task_min = tune_get("sort_task_min", sort_task_min);
+    if (tune_get("sort_threads", 0) > 0) {
+        omp_set_num_threads(tune_get("sort_threads", 0));
+    }
 
-    double end = omp_get_wtime();
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "k:n:b:m:T:r:c:s:d:K:t:Sulh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'k':
+                for (char* item = strtok(optarg, ","); item; item = strtok(NULL, ",")) {
+                    if (!strcmp(item, "all")) {
+                        for (size_t i = 0; i < num_sort_kernels && num_kernels < MAX_SORT_KERNELS; ++i) {
+                            from_all[num_kernels] = 1;
+                            kernels[num_kernels++] = &sort_kernels[i];
+                        }
+                    } else if (!find_sort_kernel(item)) {
+                        fprintf(stderr, "Unknown kernel: %s (use --list)\n", item);
+                        exit(EXIT_FAILURE);
+                    } else if (num_kernels < MAX_SORT_KERNELS) {
+                        kernels[num_kernels++] = find_sort_kernel(item);
+                    }
+                }
+                break;
+            case 'n':
+                len = strtoul(optarg, NULL, 10);
+                break;
+            case 'b':
+                threshold = atoi(optarg);
+                break;
+            case 'm':
+                sort_parallel_merge_min = strtoul(optarg, NULL, 10);
+                break;
+            case 'T':
+                sort_task_min = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                sort_radix_bits = atoi(optarg);
+                break;
+            case 'c':
+                sort_counting_max_range = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                sort_sample_bucket_len = strtoul(optarg, NULL, 10);
+                break;
+            case 'd':
+                sort_input_dist = SORT_NUM_DISTS;
+                for (int d = 0; d < SORT_NUM_DISTS; ++d) {
+                    if (!strcmp(optarg, sort_dist_names[d])) {
+                        sort_input_dist = d;
+                    }
+                }
+                if (sort_input_dist == SORT_NUM_DISTS) {
+                    fprintf(stderr, "Unknown distribution: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'K':
+                sort_input_keys = strtol(optarg, NULL, 10);
+                break;
+            case 't':
+                omp_set_num_threads(atoi(optarg));
+                break;
+            case 'S':
+                scaling = 1;
+                break;
+            case 'u':
+                tune_sort();
+                return 0;
+            case 'l':
+                for (size_t i = 0; i < num_sort_kernels; ++i) {
+                    printf("%s\n", sort_kernels[i].name);
+                }
+                return 0;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (len < 1 || threshold < 1 || (sort_radix_bits != 8 && sort_radix_bits != 11 && sort_radix_bits != 16) || sort_sample_bucket_len < 1 || sort_input_keys < 1) {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (!num_kernels) {
+        kernels[num_kernels++] = find_sort_kernel(SORT_DEFAULT_KERNEL);
+    }
+
+    const int max_threads = omp_get_max_threads();
+    printf("Array size: %zu\n", len);
+    print_tune_cache();
+    printf("Insertion sort threshold: %d, tasks above %zu elements, parallel merge above %zu elements, %d threads\n",
+           threshold, sort_task_min, sort_parallel_merge_min, max_threads);
+    printf("Sorting networks: %s\n", sort_isa_name());
+    printf("Radix digits: %d bits, counting sort up to %zu key values\n", sort_radix_bits, sort_counting_max_range);
+    printf("Sample sort buckets of about %zu elements\n", sort_sample_bucket_len);
+
+    // A dataset file is the input of every repetition, kept aside since sorting overwrites the array
+    const char* data_file = optind < argc ? argv[optind] : NULL;
+    long* array = data_file ? open_array(data_file, len, 0xA77) : create_array(len);
+    long* input = data_file ? create_array(len) : NULL;
+    if (!array || (data_file && !input)) {
+        exit(EXIT_FAILURE);
+    }
+    if (input) {
+        memcpy(input, array, len * sizeof(long));
+        sort_counting_range = key_range(input, len);
+        printf("Input: %s, keys in [%ld, %ld]\n", data_file, sort_counting_range.min, sort_counting_range.max);
+    } else {
+        sort_counting_range.max = sort_input_keys - 1;
+        printf("Input: %s keys in [0, %ld)\n", sort_dist_names[sort_input_dist], sort_input_keys);
+    }
+
+    // Counting sort allocates a histogram of the whole key range, too wide ranges are refused, or skipped from "all"
+    size_t kept = 0;
+    for (size_t kn = 0; kn < num_kernels; ++kn) {
+        const uint64_t span = (uint64_t)sort_counting_range.max - (uint64_t)sort_counting_range.min;
+        if (kernels[kn]->sort == bounded_counting_sort && span >= sort_counting_max_range) {
+            if (!from_all[kn]) {
+                fprintf(stderr, "counting needs at most --counting-max (%zu) key values\n", sort_counting_max_range);
+                exit(EXIT_FAILURE);
+            }
+            printf("Skipping counting: more than --counting-max (%zu) key values\n", sort_counting_max_range);
+            continue;
+        }
+        kernels[kept++] = kernels[kn];
+    }
+    num_kernels = kept;
+    print_memory_policy();
+
+    bench_t bench;
+    bench_init(&bench, "sort");
+    bench_set(&bench, "length", "%zu", len);
+    bench_set(&bench, "threshold", "%d", threshold);
+    bench_set(&bench, "task_min", "%zu", sort_task_min);
+    bench_set(&bench, "merge_min", "%zu", sort_parallel_merge_min);
+    bench_set(&bench, "radix_bits", "%d", sort_radix_bits);
+    bench_set(&bench, "sort_isa", "%s", sort_isa_name());
+    bench_set(&bench, "bucket_len", "%zu", sort_sample_bucket_len);
+    if (data_file) {
+        bench_set(&bench, "input", "%s", data_file);
+    } else {
+        bench_set(&bench, "dist", "%s", sort_dist_names[sort_input_dist]);
+        bench_set(&bench, "keys", "%ld", sort_input_keys);
+    }
 
     printf("\n");
-    printf("Calculation time: %lf\n", end - start);
+    printf("%-12s %8s %12s %12s %8s %10s %8s\n", "kernel", "threads", "time", "elements/s", "speedup", "efficiency", "sorted");
+    int all_sorted = 1;
+    for (size_t kn = 0; kn < num_kernels; ++kn) {
+        double base = 0;
+
+        for (int threads = scaling ? 1 : max_threads; threads <= max_threads; threads = (threads*2 > max_threads && threads < max_threads) ? max_threads : threads*2) {
+            int sorted = 0;
 
-    if (is_sorted(array, ARR_LEN)) {
+            omp_set_num_threads(threads);
+            bench_set(&bench, "threads", "%d", threads);
+            double t = bench_sort(&bench, kernels[kn], array, input, len, threshold, &sorted);
+            base = (threads == 1 || !scaling) ? t : base;
+            all_sorted &= sorted;
+
+            if (scaling) {
+                printf("%-12s %8d %12lf %12.3e %8.2lf %9.1lf%% %8s\n", kernels[kn]->name, threads, t, len / t,
+                       base / t, 100 * base / t / threads, sorted ? "yes" : "NO");
+            } else {
+                printf("%-12s %8d %12lf %12.3e %8s %10s %8s\n", kernels[kn]->name, threads, t, len / t, "-", "-", sorted ? "yes" : "NO");
+            }
+        }
+    }
+    omp_set_num_threads(max_threads);
+
+    printf("\n");
+    printf("Times are medians of %d repetitions after %d warmup runs\n", bench.reps, bench.warmup);
+    if (all_sorted) {
         printf("Array is sorted.\n");
     } else {
         printf("Array is NOT sorted!\n");
     }
+
+    if (data_file) {
+        close_array(array, len);
+        delete_array(input, len);
+    } else {
+        delete_array(array, len);
+    }
+
+    return all_sorted ? 0 : EXIT_FAILURE;
 }
@@ -0,0 +1,483 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include "random-tools.h"
+#include "memory-tools.h"
+
+/*
+    Sparse long matrices in two formats:
+
+        CSR   row i is values[row_ptr[i] .. row_ptr[i + 1]) in columns col_idx[...],
+              columns of a row ascending
+        SELL  SELL-C-sigma: rows are sorted by length inside windows of sigma rows
+              and cut into chunks of C rows. A chunk is stored column-major and
+              padded to its longest row, so element j of C consecutive rows is one
+              vector load. perm maps the sorted position back to the row.
+              sigma = 1 keeps the row order, C = rows is plain ELL.
+
+    Column indices are 32-bit: they are half of the bytes SpMV streams, and a
+    matrix with 2^32 columns would not fit in memory as dense anyway. SELL row
+    numbers are 32-bit too, so both dimensions must be at most UINT32_MAX.
+    Parallel regions are enabled by enable_omp_parallel (-DPARALLEL).
+*/
+
+extern int enable_omp_parallel;
+
+#ifndef SPARSE_SPGEMM_CHUNK
+    #define SPARSE_SPGEMM_CHUNK 64
+#endif
+
+enum {
+        SPARSE_ELEM_MAX = 100,
+        SPARSE_SELL_BLOCK = 8
+    };
+
+typedef struct {
+    size_t rows;
+    size_t cols;
+    size_t nnz;
+    size_t* row_ptr;
+    uint32_t* col_idx;
+    long* values;
+} csr_matrix_t;
+
+typedef struct {
+    size_t rows;
+    size_t cols;
+    size_t nnz;
+    size_t chunk;
+    size_t sigma;
+    size_t num_chunks;
+    size_t padded;
+    uint32_t* perm;
+    size_t* chunk_ptr;
+    uint32_t* chunk_len;
+    uint32_t* col_idx;
+    long* values;
+} sell_matrix_t;
+
+// Buffers of empty matrices still get one element, mmap does not take 0 bytes
+size_t _sparse_bytes(size_t len, size_t elem_size)
+{
+    return (len ? len : 1) * elem_size;
+}
+
+// Allocates row_ptr, the arrays of nnz elements come later with _alloc_csr_values()
+csr_matrix_t create_csr_matrix(size_t rows, size_t cols)
+{
+    csr_matrix_t A = {rows, cols, 0, NULL, NULL, NULL};
+    A.row_ptr = (size_t*)create_buffer(_sparse_bytes(rows + 1, sizeof(size_t)));
+
+    return A;
+}
+
+void _alloc_csr_values(csr_matrix_t* A)
+{
+    A->nnz = A->row_ptr[A->rows];
+    A->col_idx = (uint32_t*)create_buffer(_sparse_bytes(A->nnz, sizeof(uint32_t)));
+    A->values = (long*)create_buffer(_sparse_bytes(A->nnz, sizeof(long)));
+}
+
+void delete_csr_matrix(csr_matrix_t* A)
+{
+    delete_buffer(A->row_ptr, _sparse_bytes(A->rows + 1, sizeof(size_t)));
+    if (A->values) {
+        delete_buffer(A->col_idx, _sparse_bytes(A->nnz, sizeof(uint32_t)));
+        delete_buffer(A->values, _sparse_bytes(A->nnz, sizeof(long)));
+    }
+}
+
+// row_ptr[i + 1] holds the length of row i on entry and the end of row i on return
+void _scan_row_lengths(size_t* row_ptr, size_t rows)
+{
+    row_ptr[0] = 0;
+    for (size_t i = 0; i < rows; ++i) {
+        row_ptr[i + 1] += row_ptr[i];
+    }
+}
+
+// Uniform double in [0, 1) from a random number
+double _random_unit(uint64_t x)
+{
+    return (x >> 11) * 0x1.0p-53;
+}
+
+// rows x cols matrix with on average density*cols nonzeros per row. Row lengths are
+// mean*(skew + 1)*u^skew for uniform u: equal for skew 0, while larger skews keep the
+// mean but concentrate the nonzeros in fewer, longer rows (the longest ones are about
+// skew + 1 times the mean). Columns of a row are spread evenly with random jitter and
+// values are in [1, SPARSE_ELEM_MAX], so the same seed gives the same matrix for any
+// number of threads.
+csr_matrix_t random_csr_matrix(size_t rows, size_t cols, double density, double skew, unsigned int seed)
+{
+    csr_matrix_t A = create_csr_matrix(rows, cols);
+    const double mean = density * cols;
+
+    #pragma omp parallel for schedule(static) if (enable_omp_parallel)
+    for (size_t i = 0; i < rows; ++i) {
+        double len = mean * (skew + 1) * pow(_random_unit(random_at(seed, 2*i)), skew);
+        // Random rounding keeps the mean for densities below one per row
+        len = floor(len + _random_unit(random_at(seed, 2*i + 1)));
+        A.row_ptr[i + 1] = len < cols ? (size_t)len : cols;
+    }
+    _scan_row_lengths(A.row_ptr, rows);
+    _alloc_csr_values(&A);
+
+    #pragma omp parallel for schedule(dynamic, 256) if (enable_omp_parallel)
+    for (size_t i = 0; i < rows; ++i) {
+        const size_t begin = A.row_ptr[i];
+        const size_t len = A.row_ptr[i + 1] - begin;
+        const double width = (double)cols / len;
+
+        // One column per bucket of width cols/len, so they come out sorted and distinct
+        for (size_t j = 0; j < len; ++j) {
+            size_t lo = (size_t)(j * width);
+            size_t hi = (j + 1 == len) ? cols : (size_t)((j + 1) * width);
+            A.col_idx[begin + j] = lo + random_below(random_at(seed + 1, begin + j), hi - lo);
+            A.values[begin + j] = 1 + random_below(random_at(seed + 2, begin + j), SPARSE_ELEM_MAX);
+        }
+    }
+
+    return A;
+}
+
+// Nonzeros of a dense rows x cols matrix, counted per row and then copied in parallel
+csr_matrix_t dense_to_csr(long* M, size_t rows, size_t cols)
+{
+    csr_matrix_t A = create_csr_matrix(rows, cols);
+
+    #pragma omp parallel for schedule(static) if (enable_omp_parallel)
+    for (size_t i = 0; i < rows; ++i) {
+        size_t count = 0;
+        for (size_t j = 0; j < cols; ++j) {
+            count += M[i*cols + j] != 0;
+        }
+        A.row_ptr[i + 1] = count;
+    }
+    _scan_row_lengths(A.row_ptr, rows);
+    _alloc_csr_values(&A);
+
+    #pragma omp parallel for schedule(static) if (enable_omp_parallel)
+    for (size_t i = 0; i < rows; ++i) {
+        size_t pos = A.row_ptr[i];
+        for (size_t j = 0; j < cols; ++j) {
+            if (M[i*cols + j]) {
+                A.col_idx[pos] = j;
+                A.values[pos++] = M[i*cols + j];
+            }
+        }
+    }
+
+    return A;
+}
+
+void csr_to_dense(const csr_matrix_t* A, long* M)
+{
+    #pragma omp parallel for schedule(static) if (enable_omp_parallel)
+    for (size_t i = 0; i < A->rows; ++i) {
+        memset(&M[i*A->cols], 0, sizeof(long) * A->cols);
+        for (size_t p = A->row_ptr[i]; p < A->row_ptr[i + 1]; ++p) {
+            M[i*A->cols + A->col_idx[p]] = A->values[p];
+        }
+    }
+}
+
+// 1 if both matrices have the same shape and nonzeros
+int equal_csr(const csr_matrix_t* A, const csr_matrix_t* B)
+{
+    return A->rows == B->rows && A->cols == B->cols && A->nnz == B->nnz &&
+           !memcmp(A->row_ptr, B->row_ptr, sizeof(size_t) * (A->rows + 1)) &&
+           !memcmp(A->col_idx, B->col_idx, sizeof(uint32_t) * A->nnz) &&
+           !memcmp(A->values, B->values, sizeof(long) * A->nnz);
+}
+
+// First row that starts at or after nonzero number target
+size_t _csr_row_at_nnz(const csr_matrix_t* A, size_t target)
+{
+    size_t lo = 0, hi = A->rows;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (A->row_ptr[mid] < target) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+// y = A*x with rows split evenly between threads
+void csr_spmv_rows(const csr_matrix_t* A, const long* x, long* y)
+{
+    #pragma omp parallel for schedule(static) if (enable_omp_parallel)
+    for (size_t i = 0; i < A->rows; ++i) {
+        long sum = 0;
+        for (size_t p = A->row_ptr[i]; p < A->row_ptr[i + 1]; ++p) {
+            sum += A->values[p] * x[A->col_idx[p]];
+        }
+        y[i] = sum;
+    }
+}
+
+// y = A*x with every thread getting a contiguous range of rows holding about nnz/threads
+// nonzeros, found by binary search in row_ptr. Skewed matrices stay balanced unless a
+// single row is longer than a thread's share.
+void csr_spmv(const csr_matrix_t* A, const long* x, long* y)
+{
+    #pragma omp parallel if (enable_omp_parallel)
+    {
+        const size_t t = omp_get_thread_num();
+        const size_t num_threads = omp_get_num_threads();
+        const size_t begin = (t == 0) ? 0 : _csr_row_at_nnz(A, A->nnz * t / num_threads);
+        const size_t end = (t + 1 == num_threads) ? A->rows : _csr_row_at_nnz(A, A->nnz * (t + 1) / num_threads);
+
+        for (size_t i = begin; i < end; ++i) {
+            long sum = 0;
+            for (size_t p = A->row_ptr[i]; p < A->row_ptr[i + 1]; ++p) {
+                sum += A->values[p] * x[A->col_idx[p]];
+            }
+            y[i] = sum;
+        }
+    }
+}
+
+typedef struct {
+    uint32_t len;
+    uint32_t row;
+} _sell_row_t;
+
+int _compare_sell_rows(const void* a, const void* b)
+{
+    const _sell_row_t* x = (const _sell_row_t*)a;
+    const _sell_row_t* y = (const _sell_row_t*)b;
+
+    // Longest first, ties in row order so the permutation is deterministic
+    if (x->len != y->len) {
+        return (x->len < y->len) ? 1 : -1;
+    }
+    return (x->row > y->row) - (x->row < y->row);
+}
+
+// SELL-chunk-sigma copy of A, padding has value 0 in column 0. chunk is rounded up
+// to a multiple of SPARSE_SELL_BLOCK, the rows sell_spmv() works on at once.
+sell_matrix_t csr_to_sell(const csr_matrix_t* A, size_t chunk, size_t sigma)
+{
+    chunk = (chunk + SPARSE_SELL_BLOCK - 1) / SPARSE_SELL_BLOCK * SPARSE_SELL_BLOCK;
+    sell_matrix_t S = {A->rows, A->cols, A->nnz, chunk, sigma, (A->rows + chunk - 1) / chunk, 0,
+                       NULL, NULL, NULL, NULL, NULL};
+    _sell_row_t* order = (_sell_row_t*)malloc(_sparse_bytes(A->rows, sizeof(_sell_row_t)));
+
+    S.perm = (uint32_t*)create_buffer(_sparse_bytes(A->rows, sizeof(uint32_t)));
+    S.chunk_ptr = (size_t*)create_buffer(_sparse_bytes(S.num_chunks + 1, sizeof(size_t)));
+    S.chunk_len = (uint32_t*)create_buffer(_sparse_bytes(S.num_chunks, sizeof(uint32_t)));
+
+    #pragma omp parallel for schedule(static) if (enable_omp_parallel)
+    for (size_t w = 0; w < A->rows; w += sigma) {
+        const size_t end = (A->rows - w < sigma) ? A->rows : w + sigma;
+        for (size_t i = w; i < end; ++i) {
+            order[i].len = A->row_ptr[i + 1] - A->row_ptr[i];
+            order[i].row = i;
+        }
+        if (sigma > 1) {
+            qsort(&order[w], end - w, sizeof(_sell_row_t), _compare_sell_rows);
+        }
+    }
+
+    #pragma omp parallel for schedule(static) if (enable_omp_parallel)
+    for (size_t c = 0; c < S.num_chunks; ++c) {
+        uint32_t len = 0;
+        for (size_t p = c*chunk; p < (c + 1)*chunk && p < A->rows; ++p) {
+            S.perm[p] = order[p].row;
+            len = (order[p].len > len) ? order[p].len : len;
+        }
+        S.chunk_len[c] = len;
+        S.chunk_ptr[c + 1] = (size_t)len * chunk;
+    }
+    _scan_row_lengths(S.chunk_ptr, S.num_chunks);
+    S.padded = S.chunk_ptr[S.num_chunks];
+
+    S.col_idx = (uint32_t*)create_buffer(_sparse_bytes(S.padded, sizeof(uint32_t)));
+    S.values = (long*)create_buffer(_sparse_bytes(S.padded, sizeof(long)));
+
+    #pragma omp parallel for schedule(dynamic, 64) if (enable_omp_parallel)
+    for (size_t c = 0; c < S.num_chunks; ++c) {
+        for (size_t r = 0; r < chunk; ++r) {
+            const size_t p = c*chunk + r;
+            const size_t begin = (p < A->rows) ? A->row_ptr[S.perm[p]] : 0;
+            const size_t len = (p < A->rows) ? order[p].len : 0;
+
+            for (size_t j = 0; j < S.chunk_len[c]; ++j) {
+                const size_t dst = S.chunk_ptr[c] + j*chunk + r;
+                S.col_idx[dst] = (j < len) ? A->col_idx[begin + j] : 0;
+                S.values[dst] = (j < len) ? A->values[begin + j] : 0;
+            }
+        }
+    }
+
+    free(order);
+    return S;
+}
+
+void delete_sell_matrix(sell_matrix_t* S)
+{
+    delete_buffer(S->perm, _sparse_bytes(S->rows, sizeof(uint32_t)));
+    delete_buffer(S->chunk_ptr, _sparse_bytes(S->num_chunks + 1, sizeof(size_t)));
+    delete_buffer(S->chunk_len, _sparse_bytes(S->num_chunks, sizeof(uint32_t)));
+    delete_buffer(S->col_idx, _sparse_bytes(S->padded, sizeof(uint32_t)));
+    delete_buffer(S->values, _sparse_bytes(S->padded, sizeof(long)));
+}
+
+// Rows [r0, r0 + SPARSE_SELL_BLOCK) of one chunk: the lane loop becomes one gather
+// of x and one vector multiply-add per column of the chunk
+__attribute__((target_clones("arch=skylake-avx512", "avx2", "default")))
+void _sell_block(const long* values, const uint32_t* col_idx, size_t chunk, size_t len, const long* x, long* sum)
+{
+    for (size_t r = 0; r < SPARSE_SELL_BLOCK; ++r) {
+        sum[r] = 0;
+    }
+    for (size_t j = 0; j < len; ++j) {
+        for (size_t r = 0; r < SPARSE_SELL_BLOCK; ++r) {
+            sum[r] += values[j*chunk + r] * x[col_idx[j*chunk + r]];
+        }
+    }
+}
+
+// y = S*x, work items are blocks of SPARSE_SELL_BLOCK rows of a chunk, so plain
+// ELL (one chunk) is spread over the threads as well
+void sell_spmv(const sell_matrix_t* S, const long* x, long* y)
+{
+    #pragma omp parallel for collapse(2) schedule(dynamic, 16) if (enable_omp_parallel)
+    for (size_t c = 0; c < S->num_chunks; ++c) {
+        for (size_t r0 = 0; r0 < S->chunk; r0 += SPARSE_SELL_BLOCK) {
+            long sum[SPARSE_SELL_BLOCK];
+            const size_t base = S->chunk_ptr[c] + r0;
+
+            _sell_block(&S->values[base], &S->col_idx[base], S->chunk, S->chunk_len[c], x, sum);
+            for (size_t r = 0; r < SPARSE_SELL_BLOCK && c*S->chunk + r0 + r < S->rows; ++r) {
+                y[S->perm[c*S->chunk + r0 + r]] = sum[r];
+            }
+        }
+    }
+}
+
+int _compare_col_idx(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+// Number of scalar products of A*B, the work of SpGEMM
+size_t spgemm_products(const csr_matrix_t* A, const csr_matrix_t* B)
+{
+    size_t products = 0;
+
+    #pragma omp parallel for reduction(+: products) schedule(static) if (enable_omp_parallel)
+    for (size_t p = 0; p < A->nnz; ++p) {
+        products += B->row_ptr[A->col_idx[p] + 1] - B->row_ptr[A->col_idx[p]];
+    }
+
+    return products;
+}
+
+// C = A*B by Gustavson's row-by-row algorithm. A symbolic pass counts the columns of
+// every row of C, so the numeric pass writes straight into the final arrays. Every
+// thread keeps a marker and a dense accumulator of B->cols elements; markers hold the
+// last row that touched a column, so they never have to be cleared.
+csr_matrix_t csr_spgemm(const csr_matrix_t* A, const csr_matrix_t* B)
+{
+    csr_matrix_t C = create_csr_matrix(A->rows, B->cols);
+
+    #pragma omp parallel if (enable_omp_parallel)
+    {
+        size_t* mark = (size_t*)malloc(_sparse_bytes(B->cols, sizeof(size_t)));
+        long* acc = (long*)malloc(_sparse_bytes(B->cols, sizeof(long)));
+        for (size_t j = 0; j < B->cols; ++j) {
+            mark[j] = SIZE_MAX;
+        }
+
+        #pragma omp for schedule(dynamic, SPARSE_SPGEMM_CHUNK)
+        for (size_t i = 0; i < A->rows; ++i) {
+            size_t count = 0;
+            for (size_t pa = A->row_ptr[i]; pa < A->row_ptr[i + 1]; ++pa) {
+                const size_t k = A->col_idx[pa];
+                for (size_t pb = B->row_ptr[k]; pb < B->row_ptr[k + 1]; ++pb) {
+                    if (mark[B->col_idx[pb]] != i) {
+                        mark[B->col_idx[pb]] = i;
+                        ++count;
+                    }
+                }
+            }
+            C.row_ptr[i + 1] = count;
+        }
+
+        #pragma omp single
+        {
+            _scan_row_lengths(C.row_ptr, C.rows);
+            _alloc_csr_values(&C);
+        }
+
+        for (size_t j = 0; j < B->cols; ++j) {
+            mark[j] = SIZE_MAX;
+        }
+
+        #pragma omp for schedule(dynamic, SPARSE_SPGEMM_CHUNK)
+        for (size_t i = 0; i < A->rows; ++i) {
+            size_t pos = C.row_ptr[i];
+            for (size_t pa = A->row_ptr[i]; pa < A->row_ptr[i + 1]; ++pa) {
+                const size_t k = A->col_idx[pa];
+                const long a = A->values[pa];
+                for (size_t pb = B->row_ptr[k]; pb < B->row_ptr[k + 1]; ++pb) {
+                    const uint32_t j = B->col_idx[pb];
+                    if (mark[j] != i) {
+                        mark[j] = i;
+                        acc[j] = a * B->values[pb];
+                        C.col_idx[pos++] = j;
+                    } else {
+                        acc[j] += a * B->values[pb];
+                    }
+                }
+            }
+
+            qsort(&C.col_idx[C.row_ptr[i]], pos - C.row_ptr[i], sizeof(uint32_t), _compare_col_idx);
+            for (size_t p = C.row_ptr[i]; p < pos; ++p) {
+                C.values[p] = acc[C.col_idx[p]];
+            }
+        }
+
+        free(mark);
+        free(acc);
+    }
+
+    return C;
+}
+
+size_t csr_bytes(const csr_matrix_t* A)
+{
+    return sizeof(size_t) * (A->rows + 1) + (sizeof(uint32_t) + sizeof(long)) * A->nnz;
+}
+
+size_t sell_bytes(const sell_matrix_t* S)
+{
+    return sizeof(uint32_t) * S->rows + (sizeof(size_t) + sizeof(uint32_t)) * S->num_chunks +
+           (sizeof(uint32_t) + sizeof(long)) * S->padded;
+}
+
+size_t csr_max_row_len(const csr_matrix_t* A)
+{
+    size_t max_len = 0;
+
+    #pragma omp parallel for reduction(max: max_len) schedule(static) if (enable_omp_parallel)
+    for (size_t i = 0; i < A->rows; ++i) {
+        size_t len = A->row_ptr[i + 1] - A->row_ptr[i];
+        max_len = (len > max_len) ? len : max_len;
+    }
+
+    return max_len;
+}
@@ -0,0 +1,336 @@
+#include "sparse-tools.h"
+#include "matrix-tools.h"
+#include "array-tools.h"
+#include <getopt.h>
+#include <string.h>
+#include <omp.h>
+
+#ifdef PARALLEL
+    int enable_omp_parallel = 1;
+#else
+    int enable_omp_parallel = 0;
+#endif
+
+#ifndef SPARSE_DIM
+    #define SPARSE_DIM 1048576
+#endif
+#ifndef SPARSE_DENSITY
+    #define SPARSE_DENSITY 1e-5
+#endif
+#ifndef SPARSE_SELL_CHUNK
+    #define SPARSE_SELL_CHUNK 8
+#endif
+#ifndef SPARSE_SELL_SIGMA
+    #define SPARSE_SELL_SIGMA 256
+#endif
+#ifndef SPARSE_REPS
+    #define SPARSE_REPS 10
+#endif
+// Largest dense matrix (in elements) the convert benchmark builds
+#ifndef SPARSE_DENSE_MAX
+    #define SPARSE_DENSE_MAX (1 << 26)
+#endif
+// ELL pads every row to the longest one, beyond this fill it is not worth running
+#ifndef SPARSE_ELL_MAX_FILL
+    #define SPARSE_ELL_MAX_FILL 16
+#endif
+
+#define SPARSE_DEFAULT_KERNEL "csr-rows,csr,sell"
+
+enum {
+        MAX_KERNELS = 16,
+        SPARSE_SEED = 0x5A
+    };
+
+const char* sparse_kernels[] = {"csr-rows", "csr", "sell", "ell", "spgemm", "convert"};
+const size_t num_sparse_kernels = sizeof(sparse_kernels) / sizeof(sparse_kernels[0]);
+
+typedef struct {
+    size_t chunk;
+    size_t sigma;
+    int reps;
+    int verify;
+} sparse_options_t;
+
+void print_result(const char* name, double t, double bytes, double nnz, const char* check)
+{
+    printf("%-10s %12lf %10.2lf %12.3e %8s\n", name, t, bytes / t / 1e9, nnz / t, check);
+}
+
+// Best of reps runs of y = A*x by one of the SpMV kernels
+double time_spmv(const char* name, const csr_matrix_t* A, const sell_matrix_t* S, const long* x, long* y, int reps)
+{
+    double best = 0;
+
+    for (int r = 0; r < reps; ++r) {
+        double start = omp_get_wtime();
+        if (!strcmp(name, "csr-rows")) {
+            csr_spmv_rows(A, x, y);
+        } else if (!strcmp(name, "csr")) {
+            csr_spmv(A, x, y);
+        } else {
+            sell_spmv(S, x, y);
+        }
+        double t = omp_get_wtime() - start;
+
+        best = (r == 0 || t < best) ? t : best;
+    }
+
+    return best;
+}
+
+void bench_spmv(const char* name, const csr_matrix_t* A, const long* x, const long* y_ref, sparse_options_t options)
+{
+    const int is_sell = !strcmp(name, "sell") || !strcmp(name, "ell");
+    sell_matrix_t S = {0};
+    long* y = create_array(A->rows);
+
+    // Every kernel reads its matrix once and x and y at least once
+    double bytes = sizeof(long) * (A->rows + A->cols);
+    if (is_sell) {
+        const int ell = !strcmp(name, "ell");
+        if (ell && csr_max_row_len(A) * A->rows > SPARSE_ELL_MAX_FILL * A->nnz) {
+            printf("%-10s %12s (padding over %dx nnz, use sell)\n", name, "skipped", SPARSE_ELL_MAX_FILL);
+            delete_array(y, A->rows);
+            return;
+        }
+
+        double start = omp_get_wtime();
+        S = csr_to_sell(A, ell ? A->rows : options.chunk, ell ? 1 : options.sigma);
+        printf("%-10s C=%zu sigma=%zu, padded to %.2lfx nnz, built in %lf s\n", name, S.chunk, S.sigma,
+               (double)S.padded / (A->nnz ? A->nnz : 1), omp_get_wtime() - start);
+        bytes += sell_bytes(&S);
+    } else {
+        bytes += csr_bytes(A);
+    }
+
+    double t = time_spmv(name, A, &S, x, y, options.reps);
+
+    const char* check = "-";
+    if (options.verify) {
+        check = memcmp(y, y_ref, sizeof(long) * A->rows) ? "FAILED" : "ok";
+    }
+    print_result(name, t, bytes, A->nnz, check);
+
+    if (is_sell) {
+        delete_sell_matrix(&S);
+    }
+    delete_array(y, A->rows);
+}
+
+// C = A*A, nnz/s counts nonzeros of C. Traffic is estimated as A once, one B row per
+// nonzero of A and C once; the accumulators are assumed to stay in cache.
+void bench_spgemm(const csr_matrix_t* A, const long* x, sparse_options_t options)
+{
+    if (A->rows != A->cols) {
+        printf("%-10s %12s (square matrices only)\n", "spgemm", "skipped");
+        return;
+    }
+
+    const size_t products = spgemm_products(A, A);
+
+    double start = omp_get_wtime();
+    csr_matrix_t C = csr_spgemm(A, A);
+    double t = omp_get_wtime() - start;
+
+    const char* check = "-";
+    if (options.verify) {
+        // C*x must equal A*(A*x)
+        long* Ax = create_array(A->rows);
+        long* AAx = create_array(A->rows);
+        long* Cx = create_array(A->rows);
+
+        csr_spmv_rows(A, x, Ax);
+        csr_spmv_rows(A, Ax, AAx);
+        csr_spmv_rows(&C, x, Cx);
+        check = memcmp(Cx, AAx, sizeof(long) * A->rows) ? "FAILED" : "ok";
+
+        delete_array(Ax, A->rows);
+        delete_array(AAx, A->rows);
+        delete_array(Cx, A->rows);
+    }
+
+    double bytes = csr_bytes(A) + (sizeof(uint32_t) + sizeof(long)) * products + csr_bytes(&C);
+    printf("%-10s nnz(C)=%zu, %zu products (%.2lf per nonzero of C)\n", "spgemm", C.nnz, products,
+           (double)products / (C.nnz ? C.nnz : 1));
+    print_result("spgemm", t, bytes, C.nnz, check);
+
+    delete_csr_matrix(&C);
+}
+
+// CSR -> dense -> CSR round trip, bandwidth counts the dense matrix once per direction
+void bench_convert(const csr_matrix_t* A, sparse_options_t options)
+{
+    if (A->rows * A->cols > SPARSE_DENSE_MAX) {
+        printf("%-10s %12s (dense matrix over %d elements)\n", "convert", "skipped", SPARSE_DENSE_MAX);
+        return;
+    }
+
+    long* M = create_rect_matrix(A->rows, A->cols);
+    const double bytes = sizeof(long) * A->rows * A->cols;
+
+    double start = omp_get_wtime();
+    csr_to_dense(A, M);
+    double t = omp_get_wtime() - start;
+    print_result("to-dense", t, bytes + csr_bytes(A), A->nnz, "-");
+
+    start = omp_get_wtime();
+    csr_matrix_t B = dense_to_csr(M, A->rows, A->cols);
+    t = omp_get_wtime() - start;
+    print_result("to-csr", t, bytes + csr_bytes(&B), B.nnz, options.verify ? (equal_csr(A, &B) ? "ok" : "FAILED") : "-");
+
+    delete_csr_matrix(&B);
+    delete_rect_matrix(M, A->rows, A->cols);
+}
+
+void print_usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [options]\n", prog);
+    fprintf(stderr, "  -k, --kernel LIST     comma-separated kernels or \"all\" (default: %s)\n", SPARSE_DEFAULT_KERNEL);
+    fprintf(stderr, "  -n, --dim N|RxC       matrix size (default: %d)\n", SPARSE_DIM);
+    fprintf(stderr, "  -d, --density D       fraction of nonzeros (default: %g)\n", SPARSE_DENSITY);
+    fprintf(stderr, "  -s, --skew S          row length skew, 0 for equal rows (default: 0)\n");
+    fprintf(stderr, "  -C, --chunk N         SELL chunk height, rounded up to %d (default: %d)\n", SPARSE_SELL_BLOCK, SPARSE_SELL_CHUNK);
+    fprintf(stderr, "  -g, --sigma N         SELL sorting window in rows (default: %d)\n", SPARSE_SELL_SIGMA);
+    fprintf(stderr, "  -r, --reps N          SpMV repetitions, the best one is reported (default: %d)\n", SPARSE_REPS);
+    fprintf(stderr, "  -t, --threads N       number of OpenMP threads\n");
+    fprintf(stderr, "  -v, --verify          check every result against serial CSR SpMV\n");
+    fprintf(stderr, "  -l, --list            list available kernels\n");
+    fprintf(stderr, "  -h, --help            show this message\n");
+}
+
+int main(int argc, char** argv)
+{
+    size_t rows = SPARSE_DIM, cols = SPARSE_DIM;
+    double density = SPARSE_DENSITY, skew = 0;
+    sparse_options_t options = {SPARSE_SELL_CHUNK, SPARSE_SELL_SIGMA, SPARSE_REPS, 0};
+    char default_kernels[] = SPARSE_DEFAULT_KERNEL;
+    char* kernel_list = default_kernels;
+
+    static struct option long_options[] = {
+        {"kernel", required_argument, NULL, 'k'},
+        {"dim", required_argument, NULL, 'n'},
+        {"density", required_argument, NULL, 'd'},
+        {"skew", required_argument, NULL, 's'},
+        {"chunk", required_argument, NULL, 'C'},
+        {"sigma", required_argument, NULL, 'g'},
+        {"reps", required_argument, NULL, 'r'},
+        {"threads", required_argument, NULL, 't'},
+        {"verify", no_argument, NULL, 'v'},
+        {"list", no_argument, NULL, 'l'},
+        {"help", no_argument, NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "k:n:d:s:C:g:r:t:vlh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'k':
+                kernel_list = optarg;
+                break;
+            case 'n':
+                if (sscanf(optarg, "%zux%zu", &rows, &cols) != 2) {
+                    rows = cols = strtoul(optarg, NULL, 10);
+                }
+                break;
+            case 'd':
+                density = atof(optarg);
+                break;
+            case 's':
+                skew = atof(optarg);
+                break;
+            case 'C':
+                options.chunk = strtoul(optarg, NULL, 10);
+                break;
+            case 'g':
+                options.sigma = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                options.reps = atoi(optarg);
+                break;
+            case 't':
+                omp_set_num_threads(atoi(optarg));
+                break;
+            case 'v':
+                options.verify = 1;
+                break;
+            case 'l':
+                for (size_t i = 0; i < num_sparse_kernels; ++i) {
+                    printf("%s\n", sparse_kernels[i]);
+                }
+                return 0;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!rows || !cols || rows > UINT32_MAX || cols > UINT32_MAX || density <= 0 || density > 1 || skew < 0 ||
+            !options.chunk || !options.sigma || options.reps < 1) {
+        fprintf(stderr, "Bad matrix or SELL parameters\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const char* kernels[MAX_KERNELS] = {0};
+    size_t num_kernels = 0;
+    if (!strcmp(kernel_list, "all")) {
+        for (; num_kernels < num_sparse_kernels; ++num_kernels) {
+            kernels[num_kernels] = sparse_kernels[num_kernels];
+        }
+    } else {
+        for (char* tok = strtok(kernel_list, ","); tok && num_kernels < MAX_KERNELS; tok = strtok(NULL, ",")) {
+            size_t i = 0;
+            while (i < num_sparse_kernels && strcmp(tok, sparse_kernels[i])) {
+                ++i;
+            }
+            if (i == num_sparse_kernels) {
+                fprintf(stderr, "Unknown kernel: %s (use --list)\n", tok);
+                exit(EXIT_FAILURE);
+            }
+            kernels[num_kernels++] = sparse_kernels[i];
+        }
+    }
+
+    double start = omp_get_wtime();
+    csr_matrix_t A = random_csr_matrix(rows, cols, density, skew, SPARSE_SEED);
+    printf("Matrix: %zu x %zu, %zu nonzeros (%.2lf per row, longest %zu), generated in %lf s\n", rows, cols, A.nnz,
+           (double)A.nnz / rows, csr_max_row_len(&A), omp_get_wtime() - start);
+    printf("%d threads%s, skew %g\n", omp_get_max_threads(), enable_omp_parallel ? "" : " (parallel regions off)", skew);
+    print_memory_policy();
+
+    long* x = create_array(cols);
+    init_array(x, cols, SPARSE_SEED + 1);
+
+    // Reference result of a plain serial loop
+    long* y_ref = NULL;
+    if (options.verify) {
+        y_ref = create_array(rows);
+        for (size_t i = 0; i < rows; ++i) {
+            for (size_t p = A.row_ptr[i]; p < A.row_ptr[i + 1]; ++p) {
+                y_ref[i] += A.values[p] * x[A.col_idx[p]];
+            }
+        }
+    }
+
+    printf("\n%-10s %12s %10s %12s %8s\n", "kernel", "time", "GB/s", "nnz/s", "verify");
+    for (size_t k = 0; k < num_kernels; ++k) {
+        if (!strcmp(kernels[k], "spgemm")) {
+            bench_spgemm(&A, x, options);
+        } else if (!strcmp(kernels[k], "convert")) {
+            bench_convert(&A, options);
+        } else {
+            bench_spmv(kernels[k], &A, x, y_ref, options);
+        }
+    }
+
+    if (y_ref) {
+        delete_array(y_ref, rows);
+    }
+    delete_array(x, cols);
+    delete_csr_matrix(&A);
+
+    return 0;
+}
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <omp.h>
+
+/*
+    Per-host cache of tuned parameters. Every line of the cache file is
+
+        <host key> <parameter> <value>
+
+    where the host key is the CPU model name plus the number of logical
+    CPUs, so one file (e.g. in a shared home directory) can hold results
+    for several machines. The file is $TUNE_CACHE, ~/.parallel-programming-tune
+    by default. Programs load it at startup and fall back to compile-time
+    defaults for anything missing; `make tune` fills it.
+*/
+
+enum {
+        TUNE_MAX_ENTRIES = 256,
+        TUNE_KEY_LEN = 128,
+        TUNE_NAME_LEN = 64
+    };
+
+typedef struct {
+    char host[TUNE_KEY_LEN];
+    char name[TUNE_NAME_LEN];
+    long value;
+} tune_entry_t;
+
+typedef struct {
+    int loaded;
+    char host[TUNE_KEY_LEN];
+    char path[PATH_MAX];
+    size_t num_entries;
+    tune_entry_t entries[TUNE_MAX_ENTRIES];
+} tune_cache_t;
+
+tune_cache_t tune_cache = {0};
+
+// "<CPU model with spaces replaced by _>-<logical CPUs>"
+void _tune_host_key(char* key, size_t size)
+{
+    char model[TUNE_KEY_LEN] = "unknown";
+    char line[256] = "";
+
+    FILE* file = fopen("/proc/cpuinfo", "r");
+    while (file && fgets(line, sizeof(line), file)) {
+        if (!strncmp(line, "model name", strlen("model name"))) {
+            char* value = strchr(line, ':');
+            if (value) {
+                snprintf(model, sizeof(model), "%s", value + 2);
+                model[strcspn(model, "\n")] = '\0';
+            }
+            break;
+        }
+    }
+    if (file) {
+        fclose(file);
+    }
+
+    for (char* c = model; *c; ++c) {
+        if (*c == ' ' || *c == '\t') {
+            *c = '_';
+        }
+    }
+
+    snprintf(key, size, "%s-%ld", model, sysconf(_SC_NPROCESSORS_ONLN));
+}
+
+void _load_tune_cache()
+{
+    if (tune_cache.loaded) {
+        return;
+    }
+    tune_cache.loaded = 1;
+
+    _tune_host_key(tune_cache.host, sizeof(tune_cache.host));
+
+    const char* env = getenv("TUNE_CACHE");
+    const char* home = getenv("HOME");
+    if (env && *env) {
+        snprintf(tune_cache.path, sizeof(tune_cache.path), "%s", env);
+    } else {
+        snprintf(tune_cache.path, sizeof(tune_cache.path), "%s/.parallel-programming-tune", home ? home : ".");
+    }
+
+    FILE* file = fopen(tune_cache.path, "r");
+    if (!file) {
+        return;
+    }
+
+    tune_entry_t entry = {{0}, {0}, 0};
+    while (tune_cache.num_entries < TUNE_MAX_ENTRIES &&
+            fscanf(file, "%127s %63s %ld", entry.host, entry.name, &entry.value) == 3) {
+        tune_cache.entries[tune_cache.num_entries++] = entry;
+    }
+
+    fclose(file);
+}
+
+tune_entry_t* _find_tune_entry(const char* name)
+{
+    _load_tune_cache();
+
+    for (size_t i = 0; i < tune_cache.num_entries; ++i) {
+        tune_entry_t* entry = &tune_cache.entries[i];
+        if (!strcmp(entry->host, tune_cache.host) && !strcmp(entry->name, name)) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+const char* tune_host()
+{
+    _load_tune_cache();
+
+    return tune_cache.host;
+}
+
+// Tuned value of name for this host, or fallback if it was never tuned
+long tune_get(const char* name, long fallback)
+{
+    tune_entry_t* entry = _find_tune_entry(name);
+
+    return entry ? entry->value : fallback;
+}
+
+// Stores value for this host and rewrites the cache file, returns 0 on success
+int tune_set(const char* name, long value)
+{
+    tune_entry_t* entry = _find_tune_entry(name);
+    if (!entry) {
+        if (tune_cache.num_entries == TUNE_MAX_ENTRIES) {
+            fprintf(stderr, "Tune cache is full\n");
+            return -1;
+        }
+
+        entry = &tune_cache.entries[tune_cache.num_entries++];
+        snprintf(entry->host, sizeof(entry->host), "%s", tune_cache.host);
+        snprintf(entry->name, sizeof(entry->name), "%s", name);
+    }
+    entry->value = value;
+
+    // Written next to the old file and renamed, so readers never see a partial cache
+    char tmp_path[PATH_MAX + 8] = "";
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", tune_cache.path);
+
+    FILE* file = fopen(tmp_path, "w");
+    if (!file) {
+        perror("fopen");
+        return -1;
+    }
+    for (size_t i = 0; i < tune_cache.num_entries; ++i) {
+        fprintf(file, "%s %s %ld\n", tune_cache.entries[i].host, tune_cache.entries[i].name, tune_cache.entries[i].value);
+    }
+    if (fclose(file) || rename(tmp_path, tune_cache.path)) {
+        perror("rename");
+        return -1;
+    }
+
+    return 0;
+}
+
+// Number of parameters tuned for this host
+size_t tune_count()
+{
+    size_t count = 0;
+
+    _load_tune_cache();
+    for (size_t i = 0; i < tune_cache.num_entries; ++i) {
+        count += !strcmp(tune_cache.entries[i].host, tune_cache.host);
+    }
+
+    return count;
+}
+
+const char* tune_schedule_name(omp_sched_t kind)
+{
+    switch (kind & ~omp_sched_monotonic) {
+        case omp_sched_static:
+            return "static";
+        case omp_sched_dynamic:
+            return "dynamic";
+        case omp_sched_guided:
+            return "guided";
+        default:
+            return "auto";
+    }
+}
+
+// Sets the schedule(runtime) loops to <prefix>_schedule, <prefix>_chunk if they were tuned
+void tune_apply_schedule(const char* prefix)
+{
+    char kind[TUNE_NAME_LEN] = "", chunk[TUNE_NAME_LEN] = "";
+    snprintf(kind, sizeof(kind), "%s_schedule", prefix);
+    snprintf(chunk, sizeof(chunk), "%s_chunk", prefix);
+
+    if (_find_tune_entry(kind)) {
+        omp_set_schedule((omp_sched_t)tune_get(kind, omp_sched_dynamic), tune_get(chunk, 1));
+    }
+}
+
+// Prints where tuned values come from
+void print_tune_cache()
+{
+    size_t count = tune_count();
+
+    printf("Tune cache: %s (%zu values for %s)\n", tune_cache.path, count, tune_cache.host);
+}
@@ -1,5 +1,9 @@
 #include "../4-OpenMP-additional/matrix-tools.h"
+#include "../4-OpenMP-additional/tune-tools.h"
+#include "../4-OpenMP-additional/bench-tools.h"
 #include "cl-tools.h"
+#include <limits.h>
+#include <string.h>
 
 #define PROGRAM_FILE "matrix.cl"
 #define KERNEL_FUNC "simd_mul_matrix"
@@ -10,21 +14,46 @@
 #ifndef DEVICE_LOCAL_SIZE
     #define DEVICE_LOCAL_SIZE 16
 #endif
+#ifndef FREIVALDS_ROUNDS
+    #define FREIVALDS_ROUNDS 2
+#endif
 
 
-int main()
+int main(int argc, char** argv)
 {
     printf("Matrix size: %d x %d\n", MATRIX_DIM, MATRIX_DIM);
     printf("Maximum element size: %d\n", MATRIX_ELEM_MAX);
 
-    long* A = create_matrix(MATRIX_DIM);
-    long* B = create_matrix(MATRIX_DIM);
-    long* BT = create_matrix(MATRIX_DIM);
+    // --tune first searches DEVICE_LOCAL_SIZE for this host and saves it to the tune cache.
+    // Optional argument: directory to load A and B from (created on first use).
+    // B is transposed in place, so it is mapped copy-on-write.
+    int tune = argc > 1 && !strcmp(argv[1], "--tune");
+    const char* data_dir = argc > 1 + tune ? argv[1 + tune] : NULL;
+    size_t local_dim = tune_get("cl_matrix_local_size", DEVICE_LOCAL_SIZE);
+    print_tune_cache();
+    long* A = NULL, *B = NULL;
+    if (data_dir) {
+        char path[PATH_MAX] = "";
+        snprintf(path, sizeof(path), "%s/A-%d.bin", data_dir, MATRIX_DIM);
+        A = open_matrix(path, MATRIX_DIM, 0xA, 0);
+        snprintf(path, sizeof(path), "%s/B-%d.bin", data_dir, MATRIX_DIM);
+        B = open_matrix(path, MATRIX_DIM, 0xB, 1);
+    } else {
+        A = create_matrix(MATRIX_DIM);
+        B = create_matrix(MATRIX_DIM);
+        init_matrix(A, MATRIX_DIM, 0xA);
+        init_matrix(B, MATRIX_DIM, 0xB);
+    }
+
     long* C = create_matrix(MATRIX_DIM);
+    if (!A || !B || !C) {
+        exit(EXIT_FAILURE);
+    }
+    print_memory_policy();
 
-    init_matrix(A, MATRIX_DIM, 0xA);
-    init_matrix(B, MATRIX_DIM, 0xB);
-    transpose_matrix(B, BT, MATRIX_DIM);
+    // Kernel takes B transposed, hash is taken before B is overwritten
+    unsigned int hash_B = hash_matrix(B, MATRIX_DIM);
+    transpose_matrix_inplace(B, MATRIX_DIM);
 
     cl_int err = CL_SUCCESS;
     unsigned int cl_version = 0;
@@ -39,7 +68,7 @@ int main()
     cl_program program = build_program(context, device, PROGRAM_FILE);
 
     cl_mem device_A = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, MATRIX_DIM * MATRIX_DIM * sizeof(long), A, &err);
-    cl_mem device_B = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, MATRIX_DIM * MATRIX_DIM * sizeof(long), BT, &err);
+    cl_mem device_B = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, MATRIX_DIM * MATRIX_DIM * sizeof(long), B, &err);
     cl_mem device_C = clCreateBuffer(context, CL_MEM_READ_WRITE|CL_MEM_COPY_HOST_PTR, MATRIX_DIM * MATRIX_DIM * sizeof(long), C, &err);
     if(err != CL_SUCCESS) {
         perror("clCreateBuffer");
@@ -67,15 +96,44 @@ int main()
     printf("Running %s() on device\n", KERNEL_FUNC);
 
     size_t global_size[2] = {MATRIX_DIM, MATRIX_DIM};
-    size_t local_size[2] = {DEVICE_LOCAL_SIZE, DEVICE_LOCAL_SIZE}; //!TODO CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE
-    cl_event event = {0};
 
-    err = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global_size, local_size, 0, NULL, &event);
-    if(err != CL_SUCCESS) {
-        perror("clEnqueueNDRangeKernel");
-        exit(EXIT_FAILURE);
+    // Every run overwrites C, so candidates can be timed on the real buffers
+    if (tune) {
+        size_t max_group = 0;
+        clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_group), &max_group, NULL);
+
+        double best = 1e30;
+        for (size_t l = 4; l*l <= max_group && l <= MATRIX_DIM; l *= 2) {
+            if (MATRIX_DIM % l) {
+                continue;
+            }
+
+            size_t candidate[2] = {l, l};
+            double t = time_kernel(queue, kernel, 2, global_size, candidate);
+            printf("Local size %zu x %zu: %lf\n", l, l, t);
+            if (t < best) {
+                best = t;
+                local_dim = l;
+            }
+        }
+        tune_set("cl_matrix_local_size", local_dim);
     }
 
+    size_t local_size[2] = {local_dim, local_dim};
+    printf("Local size: %zu x %zu\n", local_dim, local_dim);
+
+    bench_t bench;
+    bench_init(&bench, "cl-matrix");
+    bench_set(&bench, "dim", "%d", MATRIX_DIM);
+    bench_set(&bench, "local_size", "%zu", local_dim);
+
+    // Kernel times come from event profiling, every run overwrites C
+    for (bench_start(&bench, "%s %d", KERNEL_FUNC, MATRIX_DIM); bench_running(&bench); ) {
+        bench_record(&bench, time_kernel(queue, kernel, 2, global_size, local_size));
+    }
+    bench_report(&bench, 2.0 * MATRIX_DIM * MATRIX_DIM * MATRIX_DIM, (double)MATRIX_DIM * MATRIX_DIM,
+                 3.0 * sizeof(long) * MATRIX_DIM * MATRIX_DIM);
+
     err = clEnqueueReadBuffer(queue, device_C, CL_TRUE, 0, MATRIX_DIM * MATRIX_DIM * sizeof(long), C, 0, NULL, NULL);
     if(err != CL_SUCCESS) {
         perror("clEnqueueReadBuffer");
@@ -84,17 +142,22 @@ int main()
 
     clFinish(queue);
 
-    cl_ulong start = 0, end = 0;
-    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
-    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
-
     printf("\n");
-    printf("Multiplication time: %lf\n", ((double)end - (double)start)/1e9);
+    printf("Multiplication time: ");
+    bench_print_times(&bench);
+    printf("\n");
 
     printf("hash(A) = %x\n", hash_matrix(A, MATRIX_DIM));
-    printf("hash(B) = %x\n", hash_matrix(B, MATRIX_DIM));
+    printf("hash(B) = %x\n", hash_B);
     printf("hash(C) = %x\n", hash_matrix(C, MATRIX_DIM));
 
+    transpose_matrix_inplace(B, MATRIX_DIM);
+    if (verify_matrix(A, B, C, MATRIX_DIM, FREIVALDS_ROUNDS, 0xF)) {
+        printf("Result verified.\n");
+    } else {
+        printf("Result is WRONG!\n");
+    }
+
     clReleaseKernel(kernel);
     clReleaseMemObject(device_A);
     clReleaseMemObject(device_B);
@@ -1,6 +1,10 @@
 #include <sys/mman.h>
 #include "cl-tools.h"
 #include <time.h>
+#include "../4-OpenMP-additional/array-tools.h"
+#include "../4-OpenMP-additional/tune-tools.h"
+#include "../4-OpenMP-additional/bench-tools.h"
+#include <string.h>
 
 #define PROGRAM_FILE "sort.cl"
 #define KERNEL_FUNC "bitonic_sort"
@@ -15,57 +19,27 @@
 
 const size_t ARR_LEN = ARRAY_LENGTH;
 
-enum {
-        ARR_ELEM_MAX = 100
-    };
-
-long* create_array(size_t len)
-{
-    const int prot_flags = PROT_READ|PROT_WRITE;
-    const int map_flags = MAP_PRIVATE|MAP_ANON;
-    void* ptr = mmap(NULL, sizeof(long)*len, prot_flags, map_flags, -1, 0);
-    if(ptr == MAP_FAILED) {
-        perror("mmap");
-        return NULL;
-    }
-
-    return (long*)ptr;
-}
-
-void delete_array(long* arr, size_t len)
+int main(int argc, char** argv)
 {
-    munmap(arr, sizeof(long)*len);
-}
-
-void init_array(long* arr, size_t len, unsigned int seed)
-{
-    srand(seed);
+    printf("Array length: %lu\n", ARR_LEN);
 
-    for (size_t i = 0; i < len; ++i) {
-        arr[i] = rand() % ARR_ELEM_MAX;
+    // --tune first searches DEVICE_LOCAL_SIZE for this host and saves it to the tune cache.
+    // Optional argument: dataset file to load the input from (created on first use)
+    int tune = argc > 1 && !strcmp(argv[1], "--tune");
+    const char* data_file = argc > 1 + tune ? argv[1 + tune] : NULL;
+    size_t local_size = tune_get("cl_sort_local_size", DEVICE_LOCAL_SIZE);
+    print_tune_cache();
+    long* array = NULL;
+    if (data_file) {
+        array = open_array(data_file, ARR_LEN, 0xA77);
+    } else {
+        array = create_array(ARR_LEN);
+        init_array(array, ARR_LEN, 0xA77);
     }
-}
-
-int is_sorted(long *array, size_t n) {
-    for (size_t i = 1; i < n; i++) {
-        if (array[i - 1] > array[i]) return 0;
+    if (!array) {
+        exit(EXIT_FAILURE);
     }
-    return 1;
-}
-
-double get_time() {
-    struct timespec ts = {0};
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-
-    return ts.tv_sec + ts.tv_nsec/1e9;
-}
-
-int main()
-{
-    printf("Array length: %lu\n", ARR_LEN);
-
-    long* array = create_array(ARR_LEN);
-    init_array(array, ARR_LEN, 0xA77);
+    print_memory_policy();
 
     cl_int err = CL_SUCCESS;
     unsigned int cl_version = 0;
@@ -96,9 +70,6 @@ int main()
     printf("Running %s() on device\n", KERNEL_FUNC);
 
     size_t global_size = ARR_LEN;
-    size_t local_size = DEVICE_LOCAL_SIZE;
-
-    double start = get_time();
 
     err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &device_array);
     err |= clSetKernelArg(kernel, 1, sizeof(int), &ARR_LEN);
@@ -107,27 +78,70 @@ int main()
         exit(EXIT_FAILURE);
     };
 
-    for (int stage = 2; stage <= ARR_LEN; stage <<= 1) {
-        for (int step = stage >> 1; step > 0; step >>= 1) {
-            err = clSetKernelArg(kernel, 2, sizeof(int), &stage);
-            err |= clSetKernelArg(kernel, 3, sizeof(int), &step);
-            if(err != CL_SUCCESS) {
-                perror("clSetKernelArg");
-                exit(EXIT_FAILURE);
-            };
-
-            err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, &local_size, 0, NULL, NULL);
-            if(err != CL_SUCCESS) {
-                perror("clEnqueueNDRangeKernel");
-                exit(EXIT_FAILURE);
-            };
-
-            clFinish(queue);
+    // Candidates are timed on the widest step of the last stage. A compare-exchange pass
+    // only permutes the data, so the full sort below still sorts it.
+    if (tune) {
+        size_t max_group = 0;
+        clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_group), &max_group, NULL);
+
+        int stage = ARR_LEN, step = ARR_LEN >> 1;
+        err = clSetKernelArg(kernel, 2, sizeof(int), &stage);
+        err |= clSetKernelArg(kernel, 3, sizeof(int), &step);
+        if(err != CL_SUCCESS) {
+            perror("clSetKernelArg");
+            exit(EXIT_FAILURE);
+        };
+
+        double best = 1e30;
+        for (size_t l = 32; l <= max_group && l <= ARR_LEN; l *= 2) {
+            double t = time_kernel(queue, kernel, 1, &global_size, &l);
+            printf("Local size %zu: %lf\n", l, t);
+            if (t < best) {
+                best = t;
+                local_size = l;
+            }
         }
+        tune_set("cl_sort_local_size", local_size);
     }
+    printf("Local size: %zu\n", local_size);
+
+    bench_t bench;
+    bench_init(&bench, "cl-sort");
+    bench_set(&bench, "length", "%zu", ARR_LEN);
+    bench_set(&bench, "local_size", "%zu", local_size);
+
+    // Every repetition uploads the unsorted host array again, outside the timer
+    for (bench_start(&bench, "bitonic_sort %zu", ARR_LEN); bench_running(&bench); ) {
+        err = clEnqueueWriteBuffer(queue, device_array, CL_TRUE, 0, ARR_LEN * sizeof(long), array, 0, NULL, NULL);
+        if(err != CL_SUCCESS) {
+            perror("clEnqueueWriteBuffer");
+            exit(EXIT_FAILURE);
+        }
+        bench_tic(&bench);
+
+        for (int stage = 2; stage <= ARR_LEN; stage <<= 1) {
+            for (int step = stage >> 1; step > 0; step >>= 1) {
+                err = clSetKernelArg(kernel, 2, sizeof(int), &stage);
+                err |= clSetKernelArg(kernel, 3, sizeof(int), &step);
+                if(err != CL_SUCCESS) {
+                    perror("clSetKernelArg");
+                    exit(EXIT_FAILURE);
+                };
+
+                err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, &local_size, 0, NULL, NULL);
+                if(err != CL_SUCCESS) {
+                    perror("clEnqueueNDRangeKernel");
+                    exit(EXIT_FAILURE);
+                };
+
+                clFinish(queue);
+            }
+        }
 
-    clFinish(queue);
-    double end = get_time();
+        clFinish(queue);
+        bench_toc(&bench);
+    }
+    bench_report(&bench, 0, ARR_LEN, 0);
 
     err = clEnqueueReadBuffer(queue, device_array, CL_TRUE, 0, ARR_LEN * sizeof(long), array, 0, NULL, NULL);
     if(err != CL_SUCCESS) {
@@ -138,7 +152,9 @@ int main()
     clFinish(queue);
 
     printf("\n");
-    printf("Calculation time: %lf\n", end - start);
+    printf("Calculation time: ");
+    bench_print_times(&bench);
+    printf("\n");
 
     if (is_sorted(array, ARR_LEN)) {
         printf("Array is sorted.\n");
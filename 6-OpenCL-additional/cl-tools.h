@@ -143,3 +143,23 @@ cl_command_queue create_queue(cl_context context, cl_device_id device, unsigned
 
     return queue;
 }
+
+// Runs kernel once with the given sizes and returns its device time in seconds from event profiling
+double time_kernel(cl_command_queue queue, cl_kernel kernel, cl_uint work_dim, const size_t* global_size, const size_t* local_size)
+{
+    cl_event event = {0};
+
+    cl_int err = clEnqueueNDRangeKernel(queue, kernel, work_dim, NULL, global_size, local_size, 0, NULL, &event);
+    if(err != CL_SUCCESS) {
+        perror("clEnqueueNDRangeKernel");
+        exit(EXIT_FAILURE);
+    }
+    clWaitForEvents(1, &event);
+
+    cl_ulong start = 0, end = 0;
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+    clReleaseEvent(event);
+
+    return ((double)end - (double)start)/1e9;
+}
@@ -6,6 +6,8 @@
 #include <future>
 #include <string>
 #include <atomic>
+#include "../4-OpenMP-additional/perf-tools.h"
+#include "../4-OpenMP-additional/bench-tools.h"
 
 std::mutex mtx;
 
@@ -57,27 +59,14 @@ void searchInBlock(const std::string& filename, const std::string& word, std::pr
     }
 }
 
-int main()
+// Searches numThreads blocks of the file in parallel, all threads are joined before returning
+bool searchFile(const std::string& filename, const std::string& word, int numThreads, std::streamsize fileSize)
 {
-    const std::string filename = "benchmark3.txt";
-    const std::string word = "SEARCHTARGET";
-    const int numThreads = 16;
-
-    std::ifstream file(filename, std::ios::ate | std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "Unable to open file." << std::endl;
-        return 1;
-    }
-
-    std::streamsize fileSize = file.tellg();
-    file.close();
-
     std::vector<std::thread> threads;
     std::vector<std::future<bool>> futures;
     std::streamsize blockSize = fileSize / numThreads;
 
-    auto start = std::chrono::steady_clock::now();
-
+    found.store(false);
     for (int i = 0; i < numThreads; ++i) {
         std::promise<bool> promise;
         futures.push_back(promise.get_future());
@@ -92,18 +81,59 @@ int main()
         try {
             if (futures[i].get()) {
                 result = true;
-                break;
             }
         } catch (const std::exception& e) {
             std::cerr << "Exception while processing result: " << e.what() << std::endl;
         }
     }
 
-    auto end = std::chrono::steady_clock::now();
-    std::chrono::duration<double> duration = end - start;
+    return result;
+}
+
+int main()
+{
+    const std::string filename = "benchmark3.txt";
+    const std::string word = "SEARCHTARGET";
+    const int numThreads = 16;
+
+    std::ifstream file(filename, std::ios::ate | std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Unable to open file." << std::endl;
+        return 1;
+    }
+
+    std::streamsize fileSize = file.tellg();
+    file.close();
+
+    bench_t bench;
+    bench_init(&bench, "search");
+    bench_set(&bench, "threads", "%d", numThreads);
+    bench_set(&bench, "file_size", "%lld", (long long)fileSize);
+
+    // Opened before the threads are created, so their counts are inherited
+    perf_region_t perf;
+    perf_region_begin(&perf, "search");
+    perf_region_pause(&perf);
+
+    bool result = false;
+    for (bench_start(&bench, "search %lld", (long long)fileSize); bench_running(&bench); ) {
+        if (bench_timed(&bench)) {
+            perf_region_resume(&perf);
+        }
+        bench_tic(&bench);
+        result = searchFile(filename, word, numThreads, fileSize);
+        bench_toc(&bench);
+        perf_region_pause(&perf);
+    }
+
+    perf_region_end(&perf);
+    bench_report(&bench, 0, 0, fileSize);
 
     std::cout << (result ? "Found word!" : "Word not found.") << std::endl;
-    std::cout << "Search time: " << duration.count() << std::endl;
+    std::cout << "Search time: ";
+    std::cout.flush();
+    bench_print_times(&bench);
+    std::cout << std::endl;
 
     return 0;
 }
@@ -0,0 +1,205 @@
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include "stable-sort.h"
+#include "../4-OpenMP-additional/random-tools.h"
+#include "../4-OpenMP-additional/perf-tools.h"
+#include "../4-OpenMP-additional/bench-tools.h"
+
+/*
+    Benchmarks the stable sorts of stable-sort.h against std::stable_sort on
+    records of a long key and a payload, with few distinct keys so stability
+    matters. Every record also carries its original position, which checks
+    the order of equal keys afterwards.
+*/
+
+enum {
+        // Records of 24 and 256 bytes
+        SMALL_PAYLOAD = 8,
+        LARGE_PAYLOAD = 240,
+        DEFAULT_LEN = 1 << 20,
+        DEFAULT_KEYS = 1000,
+        INPUT_SEED = 0x57A
+    };
+
+template <size_t Payload>
+struct Record {
+    long key;
+    size_t position;
+    char payload[Payload];
+};
+
+template <typename R>
+void initRecords(R* records, size_t n, long keys)
+{
+    for (size_t i = 0; i < n; ++i) {
+        records[i].key = random_below(random_at(INPUT_SEED, i), keys);
+        records[i].position = i;
+        std::memset(records[i].payload, (int)(i & 0xFF), sizeof(records[i].payload));
+    }
+}
+
+// Ordered by key, equal keys in their original order, and every original record
+// present once and whole: positions form a permutation and payloads match them
+template <typename R>
+bool isStablySorted(const R* records, size_t n)
+{
+    std::vector<bool> seen(n, false);
+
+    for (size_t i = 0; i < n; ++i) {
+        const size_t position = records[i].position;
+        if (position >= n || seen[position] ||
+            (unsigned char)records[i].payload[0] != (position & 0xFF) ||
+            (unsigned char)records[i].payload[sizeof(records[i].payload) - 1] != (position & 0xFF)) {
+            return false;
+        }
+        seen[position] = true;
+
+        if (i > 0 && (records[i - 1].key > records[i].key ||
+            (records[i - 1].key == records[i].key && records[i - 1].position > position))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template <typename R, typename Sort>
+double benchSort(bench_t* bench, const char* variant, R* records, size_t n, long keys, bool& stable, Sort sort)
+{
+    char label[96] = "";
+    perf_region_t perf;
+
+    snprintf(label, sizeof(label), "%s %zu %zuB", variant, n, sizeof(R));
+    perf_region_begin(&perf, label);
+    perf_region_pause(&perf);
+    for (bench_start(bench, "%s", label); bench_running(bench); ) {
+        initRecords(records, n, keys);
+        if (bench_timed(bench)) {
+            perf_region_resume(&perf);
+        }
+        bench_tic(bench);
+        sort(records, n);
+        bench_toc(bench);
+        perf_region_pause(&perf);
+    }
+    perf_region_end(&perf);
+
+    stable = isStablySorted(records, n);
+
+    return bench_report(bench, 0, n, 2.0 * sizeof(R) * n);
+}
+
+// Every variant on records with Payload bytes besides key and position, speedups are over std::stable_sort
+template <size_t Payload>
+bool benchRecords(bench_t* bench, size_t n, long keys, int threads)
+{
+    typedef Record<Payload> R;
+    R* records = allocateRecords<R>(n);
+    auto keyOf = [](const R& r) { return r.key; };
+    auto less = [](const R& a, const R& b) { return a.key < b.key; };
+    bool allStable = true;
+    double base = 0;
+
+    auto report = [&](const char* variant, double t, bool stable) {
+        base = base ? base : t;
+        allStable = allStable && stable;
+        printf("%-14s %8zu %12lf %12.3e %8.2lf %8s\n", variant, sizeof(R), t, n / t, base / t, stable ? "yes" : "NO");
+    };
+
+    bool stable = false;
+    double t = benchSort(bench, "std", records, n, keys, stable, [&](R* r, size_t len) {
+        std::stable_sort(r, r + len, less);
+    });
+    report("std", t, stable);
+
+    t = benchSort(bench, "comparator", records, n, keys, stable, [&](R* r, size_t len) {
+        stableSort(r, len, less, threads);
+    });
+    report("comparator", t, stable);
+
+    t = benchSort(bench, "key", records, n, keys, stable, [&](R* r, size_t len) {
+        stableSortByKey(r, len, keyOf, threads);
+    });
+    report("key", t, stable);
+
+    t = benchSort(bench, "index", records, n, keys, stable, [&](R* r, size_t len) {
+        indexStableSortByKey(r, len, keyOf, threads);
+    });
+    report("index", t, stable);
+
+    std::free(records);
+
+    return allStable;
+}
+
+void print_usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [options]\n", prog);
+    fprintf(stderr, "  -n, --len N        number of records (default: %d)\n", DEFAULT_LEN);
+    fprintf(stderr, "  -K, --keys N       keys are drawn from [0, N) (default: %d)\n", DEFAULT_KEYS);
+    fprintf(stderr, "  -t, --threads N    sorting threads (default: hardware concurrency)\n");
+    fprintf(stderr, "  -h, --help         show this message\n");
+}
+
+int main(int argc, char** argv)
+{
+    size_t n = DEFAULT_LEN;
+    long keys = DEFAULT_KEYS;
+    int threads = defaultSortThreads();
+
+    static struct option long_options[] = {
+        {"len", required_argument, NULL, 'n'},
+        {"keys", required_argument, NULL, 'K'},
+        {"threads", required_argument, NULL, 't'},
+        {"help", no_argument, NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "n:K:t:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                n = strtoul(optarg, NULL, 10);
+                break;
+            case 'K':
+                keys = strtol(optarg, NULL, 10);
+                break;
+            case 't':
+                threads = atoi(optarg);
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (n < 1 || keys < 1 || threads < 1) {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    bench_t bench;
+    bench_init(&bench, "stable-sort");
+    bench_set(&bench, "threads", "%d", threads);
+    bench_set(&bench, "length", "%zu", n);
+    bench_set(&bench, "keys", "%ld", keys);
+
+    printf("Records: %zu, keys in [0, %ld), %d threads\n\n", n, keys, threads);
+    printf("%-14s %8s %12s %12s %8s %8s\n", "variant", "bytes", "time", "records/s", "speedup", "stable");
+
+    bool allStable = benchRecords<SMALL_PAYLOAD>(&bench, n, keys, threads);
+    allStable = benchRecords<LARGE_PAYLOAD>(&bench, n, keys, threads) && allStable;
+
+    printf("\n");
+    printf("Times are medians of %d repetitions after %d warmup runs\n", bench.reps, bench.warmup);
+    std::cout << (allStable ? "All sorts are stable." : "Some sort is NOT stable!") << std::endl;
+
+    return allStable ? 0 : EXIT_FAILURE;
+}
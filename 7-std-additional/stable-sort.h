@@ -0,0 +1,256 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/*
+    Parallel stable sort of trivially copyable records, the merge sort of
+    ../4-OpenMP-additional/sort-kernels.h with std::thread instead of OpenMP
+    tasks and a comparator instead of <=:
+
+        stableSort(records, n, [](const Record& a, const Record& b) { return a.key < b.key; });
+        stableSortByKey(records, n, [](const Record& r) { return r.key; });
+        indexStableSortByKey(records, n, [](const Record& r) { return r.key; });
+
+    The comparator and key extractor are template parameters, so they
+    inline into the insertion sort and merge loops. Equal records keep their
+    order: leaves are insertion-sorted, moving a record only past strictly
+    greater ones, and merges and merge-path co-ranks take ties from the left
+    run first.
+
+    The record array and one buffer take turns as source and destination
+    level by level. The top log2(threads) levels sort their halves on
+    separate threads, and their merges are cut by merge-path co-ranks into
+    one slice per thread.
+
+    indexStableSortByKey() is for large payloads: it sorts (key, index)
+    pairs, moving 16 bytes per pair and level instead of whole records, and
+    then gathers every record once into its place.
+*/
+
+#ifndef STABLE_SORT_THRESHOLD
+    #define STABLE_SORT_THRESHOLD 32
+#endif
+#ifndef STABLE_SORT_PARALLEL_MERGE_MIN
+    #define STABLE_SORT_PARALLEL_MERGE_MIN (1 << 16)
+#endif
+
+template <typename T>
+T* allocateRecords(size_t n)
+{
+    T* records = static_cast<T*>(std::malloc((n ? n : 1) * sizeof(T)));
+    if (!records) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    return records;
+}
+
+int defaultSortThreads()
+{
+    const unsigned int threads = std::thread::hardware_concurrency();
+
+    return threads ? threads : 1;
+}
+
+// Moves every record past the greater ones before it, equal ones stay in front
+template <typename T, typename Less>
+void insertionSort(T* array, size_t n, const Less& less)
+{
+    for (size_t i = 1; i < n; ++i) {
+        T record = array[i];
+        size_t j = i;
+        while (j > 0 && less(record, array[j - 1])) {
+            array[j] = array[j - 1];
+            --j;
+        }
+
+        array[j] = record;
+    }
+}
+
+// How many of the first k merged records come from a (length m), ties go to a first
+template <typename T, typename Less>
+size_t mergeCoRank(size_t k, const T* a, size_t m, const T* b, size_t n, const Less& less)
+{
+    size_t lo = k > n ? k - n : 0, hi = k < m ? k : m;
+
+    while (lo < hi) {
+        size_t i = lo + (hi - lo) / 2;
+        if (!less(b[k - i - 1], a[i])) {
+            lo = i + 1;
+        } else {
+            hi = i;
+        }
+    }
+
+    return lo;
+}
+
+template <typename T, typename Less>
+void mergeRuns(const T* a, size_t m, const T* b, size_t n, T* out, const Less& less)
+{
+    size_t i = 0, j = 0, k = 0;
+
+    while (i < m && j < n) {
+        if (less(b[j], a[i])) out[k++] = b[j++];
+        else out[k++] = a[i++];
+    }
+
+    while (i < m) out[k++] = a[i++];
+    while (j < n) out[k++] = b[j++];
+}
+
+// Merges src[left, mid) and src[mid, right) into dst[left, right) on threads threads
+template <typename T, typename Less>
+void parallelMergeRuns(const T* src, T* dst, size_t left, size_t mid, size_t right, int threads, const Less& less)
+{
+    const size_t m = mid - left, n = right - mid, len = m + n;
+    const T* a = src + left;
+    const T* b = src + mid;
+
+    auto mergeSlice = [=, &less](int s) {
+        const size_t k0 = len * s / threads, k1 = len * (s + 1) / threads;
+        const size_t i0 = mergeCoRank(k0, a, m, b, n, less), i1 = mergeCoRank(k1, a, m, b, n, less);
+
+        mergeRuns(a + i0, i1 - i0, b + (k0 - i0), (k1 - i1) - (k0 - i0), dst + left + k0, less);
+    };
+
+    std::vector<std::thread> workers;
+    for (int s = 1; s < threads; ++s) {
+        workers.emplace_back(mergeSlice, s);
+    }
+    mergeSlice(0);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// Sorts array[left, right), leaving the result in temp instead if toTemp is set.
+// Both buffers are overwritten in the range.
+template <typename T, typename Less>
+void mergeSortRange(T* array, T* temp, size_t left, size_t right, bool toTemp, int threads, const Less& less)
+{
+    const size_t len = right - left;
+
+    if (len <= STABLE_SORT_THRESHOLD) {
+        T* dst = toTemp ? temp : array;
+        if (toTemp) {
+            std::memcpy(temp + left, array + left, len * sizeof(T));
+        }
+        insertionSort(dst + left, len, less);
+        return;
+    }
+
+    // Halves end up in the other buffer, then merge into this one
+    const size_t mid = left + len / 2;
+    if (threads > 1) {
+        std::thread half(mergeSortRange<T, Less>, array, temp, left, mid, !toTemp, threads / 2, std::cref(less));
+        mergeSortRange(array, temp, mid, right, !toTemp, threads - threads / 2, less);
+        half.join();
+    } else {
+        mergeSortRange(array, temp, left, mid, !toTemp, 1, less);
+        mergeSortRange(array, temp, mid, right, !toTemp, 1, less);
+    }
+
+    const T* src = toTemp ? array : temp;
+    T* dst = toTemp ? temp : array;
+    if (threads > 1 && len >= STABLE_SORT_PARALLEL_MERGE_MIN) {
+        parallelMergeRuns(src, dst, left, mid, right, threads, less);
+    } else {
+        mergeRuns(src + left, mid - left, src + mid, right - mid, dst + left, less);
+    }
+}
+
+template <typename T, typename Less>
+void stableSort(T* array, size_t n, Less less, int threads = defaultSortThreads())
+{
+    static_assert(std::is_trivially_copyable<T>::value, "stableSort() moves records with memcpy");
+
+    if (n < 2) {
+        return;
+    }
+
+    T* temp = allocateRecords<T>(n);
+    mergeSortRange(array, temp, 0, n, false, threads, less);
+    std::free(temp);
+}
+
+// Orders records by the keys keyOf() extracts, compared with <
+template <typename KeyOf>
+struct KeyLess {
+    KeyOf keyOf;
+
+    template <typename T>
+    bool operator()(const T& a, const T& b) const
+    {
+        return keyOf(a) < keyOf(b);
+    }
+};
+
+template <typename T, typename KeyOf>
+void stableSortByKey(T* array, size_t n, KeyOf keyOf, int threads = defaultSortThreads())
+{
+    stableSort(array, n, KeyLess<KeyOf>{keyOf}, threads);
+}
+
+template <typename Key>
+struct KeyIndex {
+    Key key;
+    size_t index;
+};
+
+// Sorts (key, index) pairs and then moves every record once, for records much larger than their key
+template <typename T, typename KeyOf>
+void indexStableSortByKey(T* array, size_t n, KeyOf keyOf, int threads = defaultSortThreads())
+{
+    static_assert(std::is_trivially_copyable<T>::value, "indexStableSortByKey() moves records with memcpy");
+    typedef typename std::decay<decltype(keyOf(*array))>::type Key;
+
+    if (n < 2) {
+        return;
+    }
+
+    KeyIndex<Key>* pairs = allocateRecords<KeyIndex<Key>>(n);
+    T* sorted = allocateRecords<T>(n);
+
+    auto forEachSlice = [=](const std::function<void(size_t, size_t)>& body) {
+        std::vector<std::thread> workers;
+        for (int t = 1; t < threads; ++t) {
+            workers.emplace_back(body, n * t / threads, n * (t + 1) / threads);
+        }
+        body(0, n / threads);
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    };
+
+    forEachSlice([=](size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi; ++i) {
+            pairs[i].key = keyOf(array[i]);
+            pairs[i].index = i;
+        }
+    });
+
+    // Stability keeps equal keys in index order
+    stableSort(pairs, n, [](const KeyIndex<Key>& a, const KeyIndex<Key>& b) { return a.key < b.key; }, threads);
+
+    forEachSlice([=](size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi; ++i) {
+            sorted[i] = array[pairs[i].index];
+        }
+    });
+    forEachSlice([=](size_t lo, size_t hi) {
+        std::memcpy(array + lo, sorted + lo, (hi - lo) * sizeof(T));
+    });
+
+    std::free(pairs);
+    std::free(sorted);
+}